@@ -0,0 +1,74 @@
+#include "gdalIO/gdalIO/grimpgdal.h"
+#include "mosaicSource/common/common.h"
+#include <sys/time.h>
+
+/*
+  Compare byteSwapData/byteSwapCopy with the original one element per iteration loop.
+  usage: benchByteSwap [nPixels] [nRepeat]
+*/
+
+static double wallTime()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// The original loop (2-byte types used the 32-bit swap, so are omitted here)
+static void legacySwap(void *buffer, int dataType, int64_t size)
+{
+    uint32_t *buffer4Byte = (uint32_t *)buffer;
+    uint64_t *buffer8Byte = (uint64_t *)buffer;
+    int64_t i;
+    if (GDALGetDataTypeSizeBytes(dataType) == 4)
+        for (i = 0; i < size; i++)
+            CPL_SWAP32PTR(&buffer4Byte[i]);
+    else
+        for (i = 0; i < size; i++)
+            CPL_SWAP64PTR(&buffer8Byte[i]);
+}
+
+int main(int argc, char **argv)
+{
+    int dataTypes[] = {GDT_Int16, GDT_Float32, GDT_CInt16, GDT_CFloat32, GDT_Float64};
+    int nTypes = 5, nRepeat = 10, i, r;
+    int64_t size = 4096 * 4096;
+    double t0, mb;
+    void *src, *dst;
+    //
+    if (argc > 1)
+        size = atoll(argv[1]);
+    if (argc > 2)
+        nRepeat = atoi(argv[2]);
+    fprintf(stdout, "type,method,MB/s\n");
+    for (i = 0; i < nTypes; i++)
+    {
+        mb = (double)size * GDALGetDataTypeSizeBytes(dataTypes[i]) / (1024. * 1024.);
+        src = CPLCalloc(size, GDALGetDataTypeSizeBytes(dataTypes[i]));
+        dst = CPLMalloc(size * GDALGetDataTypeSizeBytes(dataTypes[i]));
+        if (dataTypes[i] == GDT_Float32 || dataTypes[i] == GDT_Float64)
+        {
+            t0 = wallTime();
+            for (r = 0; r < nRepeat; r++)
+                legacySwap(src, dataTypes[i], size);
+            fprintf(stdout, "%s,legacy,%.1f\n", GDALGetDataTypeName(dataTypes[i]), nRepeat * mb / (wallTime() - t0));
+        }
+        t0 = wallTime();
+        for (r = 0; r < nRepeat; r++)
+            byteSwapData(src, dataTypes[i], size);
+        fprintf(stdout, "%s,inPlace,%.1f\n", GDALGetDataTypeName(dataTypes[i]), nRepeat * mb / (wallTime() - t0));
+        // Staged, as used by writeRasterAsVRT
+        t0 = wallTime();
+        for (r = 0; r < nRepeat; r++)
+        {
+            int64_t chunk = SWAPSTAGINGBYTES / GDALGetDataTypeSizeBytes(dataTypes[i]), j;
+            for (j = 0; j < size; j += chunk)
+                byteSwapCopy((char *)src + j * GDALGetDataTypeSizeBytes(dataTypes[i]), dst, dataTypes[i],
+                             (j + chunk > size) ? size - j : chunk);
+        }
+        fprintf(stdout, "%s,staged,%.1f\n", GDALGetDataTypeName(dataTypes[i]), nRepeat * mb / (wallTime() - t0));
+        CPLFree(src);
+        CPLFree(dst);
+    }
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include "gdalIO/gdalIO/grimpgdal.h"
+#include "mosaicSource/common/common.h"
+#include <math.h>
+#include <sys/time.h>
+
+/*
+  Time saveAsGeotiffWithOptions for each codec on a synthetic float32 velocity grid and report MB/s.
+  usage: benchCompression [size] [outputDir]
+*/
+
+static double wallTime()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Smooth flow field with noise and a nodata margin, roughly like a speed mosaic.
+static float *makeVelocityGrid(int size, float noDataValue)
+{
+    float *data = (float *)CPLMalloc(sizeof(float) * (size_t)size * size);
+    int i, j;
+    srand(1);
+    for (i = 0; i < size; i++)
+    {
+        for (j = 0; j < size; j++)
+        {
+            double r = hypot(i - size * 0.5, j - size * 0.5) / size;
+            if (r > 0.45)
+                data[(size_t)i * size + j] = noDataValue;
+            else
+                data[(size_t)i * size + j] = (float)(1000.0 * exp(-8.0 * r) + (rand() % 1000) * 0.001);
+        }
+    }
+    return data;
+}
+
+int main(int argc, char **argv)
+{
+    char *codecs[] = {"NONE", "DEFLATE", "ZSTD", "LZW", "LERC"};
+    char *drivers[] = {"GTiff", "COG"};
+    int predictors[] = {1, 3, 3, 3, 1};
+    int nCodecs = 5, size = 4096, i, j;
+    char *outputDir = ".", fileName[2048];
+    double geoTransform[6], t0, mb;
+    float *data;
+    tiffWriteOptions options;
+    //
+    if (argc > 1)
+        size = atoi(argv[1]);
+    if (argc > 2)
+        outputDir = argv[2];
+    GDALAllRegister();
+    data = makeVelocityGrid(size, -2.0e9);
+    computeGeoTransform(geoTransform, -300000., -2500000., size, size, 200., 200.);
+    mb = sizeof(float) * (double)size * size / (1024. * 1024.);
+    fprintf(stdout, "driver,codec,size,seconds,MB/s\n");
+    for (i = 0; i < 2; i++)
+    {
+        for (j = 0; j < nCodecs; j++)
+        {
+            initTiffWriteOptions(&options);
+            strcpy(options.codec, codecs[j]);
+            options.predictor = predictors[j];
+            options.tiled = TRUE;
+            sprintf(fileName, "%s/benchCompression.%s.%s.tif", outputDir, drivers[i], codecs[j]);
+            t0 = wallTime();
+            saveAsGeotiffWithOptions(fileName, data, size, size, geoTransform, "3413", NULL, drivers[i],
+                                     GDT_Float32, -2.0e9, &options);
+            t0 = wallTime() - t0;
+            fprintf(stdout, "%s,%s,%i,%.3f,%.1f\n", drivers[i], codecs[j], size, t0, mb / t0);
+            unlink(fileName);
+        }
+    }
+    CPLFree(data);
+    return 0;
+}
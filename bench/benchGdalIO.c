@@ -0,0 +1,277 @@
+#include "gdalIO/gdalIO/grimpgdal.h"
+#include "mosaicSource/common/common.h"
+#include <math.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/*
+  Benchmark harness for the gdalIO library. Synthetic rasters are generated locally and each operation
+  is timed for every size, data type, and codec requested. Results go to stdout as one JSON object per
+  line with wall time, MB/s, and peak RSS (reset before each case on Linux).
+
+  usage: benchGdalIO [-sizes 1024,4096,...] [-types Float32,Int16,...] [-codecs DEFLATE,ZSTD,...]
+                     [-dir scratchDir] [-repeat n]
+*/
+
+#define MAXLIST 32
+
+typedef struct benchConfig {
+    int sizes[MAXLIST], nSizes;
+    int dataTypes[MAXLIST], nTypes;
+    char *codecs[MAXLIST];
+    int nCodecs;
+    char *dir;
+    int repeat;
+} benchConfig;
+
+static double wallTime()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Reset the peak RSS high water mark where the kernel allows it.
+static void resetPeakRSS()
+{
+#ifdef __linux__
+    FILE *fp = fopen("/proc/self/clear_refs", "w");
+    if (fp != NULL)
+    {
+        fputs("5", fp);
+        fclose(fp);
+    }
+#endif
+}
+
+// Peak RSS in MB (since the last reset on Linux, otherwise for the process)
+static double peakRSS()
+{
+#ifdef __linux__
+    char line[256];
+    long kb = -1;
+    FILE *fp = fopen("/proc/self/status", "r");
+    if (fp != NULL)
+    {
+        while (fgets(line, sizeof(line), fp) != NULL)
+            if (sscanf(line, "VmHWM: %ld kB", &kb) == 1)
+                break;
+        fclose(fp);
+    }
+    if (kb >= 0)
+        return kb / 1024.;
+#endif
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / (1024. * 1024.);
+#else
+    return usage.ru_maxrss / 1024.;
+#endif
+}
+
+static void report(char *op, int dataType, int size, char *codec, double seconds, double mb)
+{
+    fprintf(stdout, "{\"op\": \"%s\", \"type\": \"%s\", \"size\": %i, \"codec\": \"%s\", \"seconds\": %.4f, "
+                    "\"MBps\": %.1f, \"peakRSSMB\": %.1f}\n",
+            op, GDALGetDataTypeName(dataType), size, codec == NULL ? "" : codec, seconds, mb / seconds, peakRSS());
+    fflush(stdout);
+}
+
+// Smooth field with noise and a nodata margin, scaled to the type's range.
+static void *makeGrid(int size, int dataType, double noDataValue)
+{
+    size_t i, j, n = (size_t)size * size;
+    double *row = (double *)CPLMalloc(sizeof(double) * size);
+    void *data = CPLMalloc(n * GDALGetDataTypeSizeBytes(dataType));
+    double scale = (dataType == GDT_Byte) ? 0.2 : 1.0;
+    srand(1);
+    for (i = 0; i < (size_t)size; i++)
+    {
+        for (j = 0; j < (size_t)size; j++)
+        {
+            double r = hypot(i - size * 0.5, j - size * 0.5) / size;
+            row[j] = (r > 0.45) ? noDataValue : scale * (1000.0 * exp(-8.0 * r) + (rand() % 1000) * 0.001);
+        }
+        // Let GDAL do the type conversion
+        GDALCopyWords(row, GDT_Float64, sizeof(double), (char *)data + i * size * GDALGetDataTypeSizeBytes(dataType),
+                      dataType, GDALGetDataTypeSizeBytes(dataType), size);
+    }
+    CPLFree(row);
+    return data;
+}
+
+static int parseList(char *arg, char **items)
+{
+    int n = 0;
+    char *token = strtok(arg, ",");
+    while (token != NULL && n < MAXLIST)
+    {
+        items[n++] = token;
+        token = strtok(NULL, ",");
+    }
+    return n;
+}
+
+static void parseArgs(int argc, char **argv, benchConfig *config)
+{
+    char *items[MAXLIST];
+    int i, j;
+    // Defaults
+    config->sizes[0] = 1024;
+    config->sizes[1] = 4096;
+    config->nSizes = 2;
+    config->dataTypes[0] = GDT_Float32;
+    config->dataTypes[1] = GDT_Int16;
+    config->nTypes = 2;
+    config->codecs[0] = "DEFLATE";
+    config->codecs[1] = "ZSTD";
+    config->codecs[2] = "LZW";
+    config->nCodecs = 3;
+    config->dir = ".";
+    config->repeat = 1;
+    for (i = 1; i < argc - 1; i += 2)
+    {
+        if (strcmp(argv[i], "-sizes") == 0)
+        {
+            config->nSizes = parseList(argv[i + 1], items);
+            for (j = 0; j < config->nSizes; j++)
+                config->sizes[j] = atoi(items[j]);
+        }
+        else if (strcmp(argv[i], "-types") == 0)
+        {
+            config->nTypes = parseList(argv[i + 1], items);
+            for (j = 0; j < config->nTypes; j++)
+                if ((config->dataTypes[j] = GDALGetDataTypeByName(items[j])) == GDT_Unknown)
+                    error("benchGdalIO: unknown type %s", items[j]);
+        }
+        else if (strcmp(argv[i], "-codecs") == 0)
+            config->nCodecs = parseList(argv[i + 1], config->codecs);
+        else if (strcmp(argv[i], "-dir") == 0)
+            config->dir = argv[i + 1];
+        else if (strcmp(argv[i], "-repeat") == 0)
+            config->repeat = atoi(argv[i + 1]);
+        else
+            error("benchGdalIO: unknown option %s", argv[i]);
+    }
+}
+
+// Remove file and any .aux.xml sidecar GDAL left with it.
+static void removeFile(const char *file)
+{
+    char auxFile[2048];
+    unlink(file);
+    snprintf(auxFile, sizeof(auxFile), "%s.aux.xml", file);
+    unlink(auxFile);
+}
+
+static void benchCase(benchConfig *config, int size, int dataType)
+{
+    char rawFile[2048], vrtFile[2048], tiffFiles[3][2048], stackFile[2048];
+    const char *stackBands[3];
+    double geoTransform[6], t0, mb;
+    double noDataValue = (dataType == GDT_Byte || dataType == GDT_UInt16 || dataType == GDT_UInt32) ? 0 : -30000;
+    float noDataValues[3] = {noDataValue, noDataValue, noDataValue};
+    int xSize, ySize, readType, i, r;
+    dictNode *metaData = NULL;
+    tiffWriteOptions options;
+    void *data, *readData;
+    //
+    data = makeGrid(size, dataType, noDataValue);
+    mb = (double)size * size * GDALGetDataTypeSizeBytes(dataType) / (1024. * 1024.);
+    computeGeoTransform(geoTransform, -300000., -2500000., size, size, 200., 200.);
+    insert_node(&metaData, "bench", "benchGdalIO");
+    sprintf(rawFile, "%s/benchGdalIO.%s.%i", config->dir, GDALGetDataTypeName(dataType), size);
+    sprintf(vrtFile, "%s.vrt", rawFile);
+    // Byte swap
+    for (r = 0; r < config->repeat; r++)
+    {
+        resetPeakRSS();
+        t0 = wallTime();
+        byteSwapData(data, dataType, (int64_t)size * size);
+        byteSwapData(data, dataType, (int64_t)size * size);
+        report("byteSwapData", dataType, size, NULL, (wallTime() - t0) * 0.5, mb);
+    }
+    // Raw writes and read back
+    for (r = 0; r < config->repeat; r++)
+    {
+        resetPeakRSS();
+        t0 = wallTime();
+        writeRasterAsVRT(data, rawFile, size, size, dataType, 1, geoTransform, FALSE, metaData);
+        report("writeRasterAsVRT", dataType, size, NULL, wallTime() - t0, mb);
+        resetPeakRSS();
+        t0 = wallTime();
+        writeRasterAsVRTDirect(data, rawFile, size, size, dataType, 1, geoTransform, FALSE, metaData, NULL);
+        report("writeRasterAsVRTDirect", dataType, size, NULL, wallTime() - t0, mb);
+        dictNode *readMeta = NULL;
+        resetPeakRSS();
+        t0 = wallTime();
+        readData = readRasterVRT(vrtFile, 1, &xSize, &ySize, &readType, &readMeta);
+        report("readRasterVRT", dataType, size, NULL, wallTime() - t0, mb);
+        CPLFree(readData);
+        free_dictionary(readMeta);
+        readMeta = NULL;
+        resetPeakRSS();
+        t0 = wallTime();
+        readData = readRasterVRTPooled(vrtFile, 1, &xSize, &ySize, &readType, &readMeta);
+        report("readRasterVRTPooled", dataType, size, NULL, wallTime() - t0, mb);
+        releaseData(readData);
+        free_dictionary(readMeta);
+    }
+    // Tiffs per codec
+    for (i = 0; i < config->nCodecs; i++)
+    {
+        initTiffWriteOptions(&options);
+        snprintf(options.codec, sizeof(options.codec), "%s", config->codecs[i]);
+        options.tiled = TRUE;
+        for (r = 0; r < config->repeat; r++)
+        {
+            sprintf(tiffFiles[0], "%s/benchGdalIO.%s.%i.%s.vx.tif", config->dir, GDALGetDataTypeName(dataType),
+                    size, config->codecs[i]);
+            resetPeakRSS();
+            t0 = wallTime();
+            saveAsGeotiffWithOptions(tiffFiles[0], data, size, size, geoTransform, "3413", metaData, "GTiff",
+                                     dataType, noDataValue, &options);
+            report("saveAsGeotiff.GTiff", dataType, size, config->codecs[i], wallTime() - t0, mb);
+            sprintf(tiffFiles[1], "%s/benchGdalIO.%s.%i.%s.vy.tif", config->dir, GDALGetDataTypeName(dataType),
+                    size, config->codecs[i]);
+            resetPeakRSS();
+            t0 = wallTime();
+            saveAsGeotiffWithOptions(tiffFiles[1], data, size, size, geoTransform, "3413", metaData, "COG",
+                                     dataType, noDataValue, &options);
+            report("saveAsGeotiff.COG", dataType, size, config->codecs[i], wallTime() - t0, mb);
+        }
+        // Stack the tiffs just written
+        sprintf(tiffFiles[2], "%s", tiffFiles[0]);
+        for (r = 0; r < 3; r++)
+            stackBands[r] = tiffFiles[r];
+        sprintf(stackFile, "%s/benchGdalIO.%s.%i.%s.stack.vrt", config->dir, GDALGetDataTypeName(dataType), size,
+                config->codecs[i]);
+        resetPeakRSS();
+        t0 = wallTime();
+        makeTiffVRT(stackFile, stackBands, 3, noDataValues, metaData);
+        report("makeTiffVRT", dataType, size, config->codecs[i], wallTime() - t0, 0.);
+        removeFile(tiffFiles[0]);
+        removeFile(tiffFiles[1]);
+        removeFile(stackFile);
+    }
+    removeFile(rawFile);
+    removeFile(vrtFile);
+    // ENVI replaces the extension (SUFFIX=REPLACE), so the header is not rawFile.hdr
+    unlink(CPLResetExtension(rawFile, "hdr"));
+    free_dictionary(metaData);
+    CPLFree(data);
+}
+
+int main(int argc, char **argv)
+{
+    benchConfig config;
+    int i, j;
+    //
+    parseArgs(argc, argv, &config);
+    GDALAllRegister();
+    for (i = 0; i < config.nSizes; i++)
+        for (j = 0; j < config.nTypes; j++)
+            benchCase(&config, config.sizes[i], config.dataTypes[j]);
+    return 0;
+}
@@ -0,0 +1,345 @@
+#include <pthread.h>
+#include "gdalIO/gdalIO/grimpgdal.h"
+#include "mosaicSource/common/common.h"
+
+/*
+  Asynchronous output. A writer has a pool of threads that run saveAsGeotiff(WithOptions),
+  writeRasterAsVRT, and makeTiffVRT from a bounded FIFO queue, so the next product can be computed while
+  the last one is compressed and written. Submitting blocks while the queue is full (backpressure).
+  Each submit returns a handle for waitAsyncWrite/releaseAsyncWrite. Arguments are copied, except data:
+  with ownsData TRUE the writer frees it (releaseData) when done, otherwise the caller must leave it
+  untouched until the write completes. A job can depend on earlier jobs from the same writer (e.g., a tiff VRT on
+  its bands), and runs after they complete. Write failures exit through error(), as for the synchronous
+  calls, so a job that completes has been written.
+*/
+
+#define ASYNCWRITE_GEOTIFF 0
+#define ASYNCWRITE_VRT 1
+#define ASYNCWRITE_TIFFVRT 2
+
+struct asyncWrite {
+    // Parameters
+    int type;
+    char *fileName;
+    void *data;
+    int ownsData;
+    int xSize, ySize, dataType;
+    double geoTransform[6];
+    int hasGeoTransform;
+    dictNode *metaData;
+    char *epsg, *driverType;   // Geotiff
+    float noDataValue;
+    tiffWriteOptions options;
+    int hasOptions;
+    int band, byteSwap;        // VRT
+    char **bands;              // Tiff VRT
+    int nBands;
+    float *noDataValues;
+    asyncWrite **after;        // Dependencies
+    int nAfter;
+    // State
+    int done;
+    int refCount;              // Held by the writer until done, and by the caller until released
+    pthread_cond_t doneCond;
+    asyncWrite *next;          // Queue
+    asyncWriter *writer;
+};
+
+struct asyncWriter {
+    pthread_t *threads;
+    int nThreads;
+    int maxQueued;
+    asyncWrite *head, *tail;
+    int nQueued;
+    int nPending;              // Queued or running
+    int shutdown;
+    pthread_mutex_t mutex;
+    pthread_cond_t notEmpty, notFull, idle;
+};
+
+static dictNode *copyDictionary(dictNode *metaData)
+{
+    dictNode *copy = NULL, *node;
+    dictIndex *index = create_dict_index(&copy);
+    ifNullError(index, "copyDictionary: Could not index metadata\n");
+    for (node = metaData; node != NULL; node = node->next)
+        dict_index_insert(index, node->key, node->value);
+    free_dict_index(index);
+    return copy;
+}
+
+// Drop a reference, called with the writer mutex held.
+static void unrefAsyncWrite(asyncWrite *job)
+{
+    int i;
+    if (--job->refCount > 0)
+        return;
+    if (job->ownsData == TRUE)
+        releaseData(job->data);
+    CPLFree(job->fileName);
+    CPLFree(job->epsg);
+    CPLFree(job->driverType);
+    CSLDestroy(job->bands);
+    CPLFree(job->noDataValues);
+    free_dictionary(job->metaData);
+    for (i = 0; i < job->nAfter; i++)
+        unrefAsyncWrite(job->after[i]);
+    CPLFree(job->after);
+    pthread_cond_destroy(&job->doneCond);
+    CPLFree(job);
+}
+
+static void runAsyncWrite(asyncWrite *job)
+{
+    switch (job->type)
+    {
+    case ASYNCWRITE_GEOTIFF:
+        saveAsGeotiffWithOptions(job->fileName, job->data, job->xSize, job->ySize, job->geoTransform, job->epsg,
+                                 job->metaData, job->driverType, job->dataType, job->noDataValue,
+                                 (job->hasOptions == TRUE) ? &job->options : NULL);
+        break;
+    case ASYNCWRITE_VRT:
+        writeRasterAsVRT(job->data, job->fileName, job->xSize, job->ySize, job->dataType, job->band,
+                         (job->hasGeoTransform == TRUE) ? job->geoTransform : NULL, job->byteSwap, job->metaData);
+        break;
+    case ASYNCWRITE_TIFFVRT:
+        makeTiffVRT(job->fileName, (const char **)job->bands, job->nBands, job->noDataValues, job->metaData);
+        break;
+    default:
+        break;
+    }
+}
+
+static void *asyncWriteWorker(void *arg)
+{
+    asyncWriter *writer = (asyncWriter *)arg;
+    asyncWrite *job;
+    int i;
+    pthread_mutex_lock(&writer->mutex);
+    while (TRUE)
+    {
+        while (writer->head == NULL && writer->shutdown == FALSE)
+            pthread_cond_wait(&writer->notEmpty, &writer->mutex);
+        if (writer->head == NULL)
+            break;
+        job = writer->head;
+        writer->head = job->next;
+        if (writer->head == NULL)
+            writer->tail = NULL;
+        writer->nQueued--;
+        pthread_cond_signal(&writer->notFull);
+        // Dependencies were queued earlier, so they are already running or done
+        for (i = 0; i < job->nAfter; i++)
+            while (job->after[i]->done == FALSE)
+                pthread_cond_wait(&job->after[i]->doneCond, &writer->mutex);
+        pthread_mutex_unlock(&writer->mutex);
+        runAsyncWrite(job);
+        pthread_mutex_lock(&writer->mutex);
+        // Free owned data as soon as possible
+        if (job->ownsData == TRUE)
+        {
+            releaseData(job->data);
+            job->data = NULL;
+        }
+        job->done = TRUE;
+        pthread_cond_broadcast(&job->doneCond);
+        unrefAsyncWrite(job);
+        if (--writer->nPending == 0)
+            pthread_cond_broadcast(&writer->idle);
+    }
+    pthread_mutex_unlock(&writer->mutex);
+    return NULL;
+}
+
+/*
+  Start a writer with nThreads workers (< 1 for 2) and at most maxQueued jobs waiting (< 1 for nThreads).
+  Memory held by queued jobs is bounded by maxQueued + nThreads buffers.
+*/
+asyncWriter *createAsyncWriter(int nThreads, int maxQueued)
+{
+    asyncWriter *writer = (asyncWriter *)CPLCalloc(1, sizeof(asyncWriter));
+    int i;
+    writer->nThreads = (nThreads < 1) ? 2 : nThreads;
+    writer->maxQueued = (maxQueued < 1) ? writer->nThreads : maxQueued;
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->notEmpty, NULL);
+    pthread_cond_init(&writer->notFull, NULL);
+    pthread_cond_init(&writer->idle, NULL);
+    writer->threads = (pthread_t *)CPLMalloc(sizeof(pthread_t) * writer->nThreads);
+    for (i = 0; i < writer->nThreads; i++)
+        if (pthread_create(&writer->threads[i], NULL, asyncWriteWorker, writer) != 0)
+            error("createAsyncWriter: Could not start writer thread\n");
+    return writer;
+}
+
+static asyncWrite *newAsyncWrite(int type, const char *fileName, void *data, int ownsData, asyncWrite **after,
+                                 int nAfter)
+{
+    asyncWrite *job = (asyncWrite *)CPLCalloc(1, sizeof(asyncWrite));
+    int i;
+    job->type = type;
+    job->fileName = CPLStrdup(fileName);
+    job->data = data;
+    job->ownsData = ownsData;
+    job->refCount = 2;
+    pthread_cond_init(&job->doneCond, NULL);
+    if (nAfter > 0)
+    {
+        job->after = (asyncWrite **)CPLMalloc(sizeof(asyncWrite *) * nAfter);
+        for (i = 0; i < nAfter; i++)
+            job->after[i] = after[i];
+        job->nAfter = nAfter;
+    }
+    return job;
+}
+
+// Queue job, blocking while the queue is full.
+static asyncWrite *submitAsyncWrite(asyncWriter *writer, asyncWrite *job)
+{
+    int i;
+    pthread_mutex_lock(&writer->mutex);
+    if (writer->shutdown == TRUE)
+        error("submitAsyncWrite: Writer is closed\n");
+    for (i = 0; i < job->nAfter; i++)
+    {
+        if (job->after[i]->writer != writer)
+            error("submitAsyncWrite: Dependency from another writer\n");
+        job->after[i]->refCount++;
+    }
+    while (writer->nQueued >= writer->maxQueued)
+        pthread_cond_wait(&writer->notFull, &writer->mutex);
+    job->writer = writer;
+    if (writer->tail != NULL)
+        writer->tail->next = job;
+    else
+        writer->head = job;
+    writer->tail = job;
+    writer->nQueued++;
+    writer->nPending++;
+    pthread_cond_signal(&writer->notEmpty);
+    pthread_mutex_unlock(&writer->mutex);
+    return job;
+}
+
+/*
+  Queue saveAsGeotiffWithOptions (options may be NULL for defaults). after/nAfter are jobs that must
+  complete first (NULL/0 for none).
+*/
+asyncWrite *asyncSaveAsGeotiff(asyncWriter *writer, const char *filename, void *data, int ownsData, int32_t width,
+                               int32_t height, double *geotransform, const char *epsg_code, dictNode *metaData,
+                               char *driverType, int32_t dataType, float noDataValue, tiffWriteOptions *options,
+                               asyncWrite **after, int nAfter)
+{
+    asyncWrite *job = newAsyncWrite(ASYNCWRITE_GEOTIFF, filename, data, ownsData, after, nAfter);
+    job->xSize = width;
+    job->ySize = height;
+    job->dataType = dataType;
+    memcpy(job->geoTransform, geotransform, sizeof(job->geoTransform));
+    job->hasGeoTransform = TRUE;
+    job->epsg = CPLStrdup(epsg_code);
+    job->driverType = CPLStrdup(driverType);
+    job->metaData = copyDictionary(metaData);
+    job->noDataValue = noDataValue;
+    if (options != NULL)
+    {
+        job->options = *options;
+        job->hasOptions = TRUE;
+    }
+    return submitAsyncWrite(writer, job);
+}
+
+// Queue writeRasterAsVRT.
+asyncWrite *asyncWriteRasterAsVRT(asyncWriter *writer, void *buffer, int ownsData, char *fileName, int xSize,
+                                  int ySize, int dataType, int band, double *geoTransform, int byteSwap,
+                                  dictNode *metaData, asyncWrite **after, int nAfter)
+{
+    asyncWrite *job = newAsyncWrite(ASYNCWRITE_VRT, fileName, buffer, ownsData, after, nAfter);
+    job->xSize = xSize;
+    job->ySize = ySize;
+    job->dataType = dataType;
+    if (geoTransform != NULL)
+    {
+        memcpy(job->geoTransform, geoTransform, sizeof(job->geoTransform));
+        job->hasGeoTransform = TRUE;
+    }
+    job->band = band;
+    job->byteSwap = byteSwap;
+    job->metaData = copyDictionary(metaData);
+    return submitAsyncWrite(writer, job);
+}
+
+// Queue makeTiffVRT, normally after the jobs writing its bands.
+asyncWrite *asyncMakeTiffVRT(asyncWriter *writer, char *vrtFile, const char **bands, int nBands,
+                             float *noDataValues, dictNode *metaData, asyncWrite **after, int nAfter)
+{
+    asyncWrite *job = newAsyncWrite(ASYNCWRITE_TIFFVRT, vrtFile, NULL, FALSE, after, nAfter);
+    int i;
+    for (i = 0; i < nBands; i++)
+        job->bands = CSLAddString(job->bands, bands[i]);
+    job->nBands = nBands;
+    if (noDataValues != NULL)
+    {
+        job->noDataValues = (float *)CPLMalloc(sizeof(float) * nBands);
+        memcpy(job->noDataValues, noDataValues, sizeof(float) * nBands);
+    }
+    job->metaData = copyDictionary(metaData);
+    return submitAsyncWrite(writer, job);
+}
+
+// Non-blocking check for completion.
+int asyncWriteDone(asyncWrite *handle)
+{
+    int done;
+    pthread_mutex_lock(&handle->writer->mutex);
+    done = handle->done;
+    pthread_mutex_unlock(&handle->writer->mutex);
+    return done;
+}
+
+// Wait for a write and release the handle.
+void waitAsyncWrite(asyncWrite *handle)
+{
+    asyncWriter *writer = handle->writer;
+    pthread_mutex_lock(&writer->mutex);
+    while (handle->done == FALSE)
+        pthread_cond_wait(&handle->doneCond, &writer->mutex);
+    unrefAsyncWrite(handle);
+    pthread_mutex_unlock(&writer->mutex);
+}
+
+// Release a handle without waiting (the write still completes).
+void releaseAsyncWrite(asyncWrite *handle)
+{
+    asyncWriter *writer = handle->writer;
+    pthread_mutex_lock(&writer->mutex);
+    unrefAsyncWrite(handle);
+    pthread_mutex_unlock(&writer->mutex);
+}
+
+// Wait for all submitted writes.
+void flushAsyncWriter(asyncWriter *writer)
+{
+    pthread_mutex_lock(&writer->mutex);
+    while (writer->nPending > 0)
+        pthread_cond_wait(&writer->idle, &writer->mutex);
+    pthread_mutex_unlock(&writer->mutex);
+}
+
+// Flush, stop the workers, and free the writer. Outstanding handles must be released first.
+void closeAsyncWriter(asyncWriter *writer)
+{
+    int i;
+    flushAsyncWriter(writer);
+    pthread_mutex_lock(&writer->mutex);
+    writer->shutdown = TRUE;
+    pthread_cond_broadcast(&writer->notEmpty);
+    pthread_mutex_unlock(&writer->mutex);
+    for (i = 0; i < writer->nThreads; i++)
+        pthread_join(writer->threads[i], NULL);
+    CPLFree(writer->threads);
+    pthread_mutex_destroy(&writer->mutex);
+    pthread_cond_destroy(&writer->notEmpty);
+    pthread_cond_destroy(&writer->notFull);
+    pthread_cond_destroy(&writer->idle);
+    CPLFree(writer);
+}
@@ -0,0 +1,204 @@
+#include <math.h>
+#include "gdalIO/gdalIO/grimpgdal.h"
+#include "mosaicSource/common/common.h"
+
+/*
+  Band statistics and histograms computed from an in-memory buffer, so writers can store them with the
+  data and readers never need a separate stats pass. Pixels are converted in cache sized chunks to
+  double with GDALCopyWords (which handles all real types), and accumulated in independent branch-free
+  lanes that the compiler can vectorize. Sums are of values shifted by the first valid value for a
+  stable variance. The histogram is filled in the same pass when its range is given, otherwise in a
+  second pass over the buffer once the range is known.
+*/
+
+#define STATSCHUNK 4096
+#define STATSLANES 4
+
+typedef struct statAccumulator {
+    double shift;
+    double sum[STATSLANES], sumSq[STATSLANES];
+    double min[STATSLANES], max[STATSLANES];
+    int64_t count[STATSLANES];
+} statAccumulator;
+
+static int isValid(double value, double noData, int hasNoData)
+{
+    return !isnan(value) && !(hasNoData && value == noData);
+}
+
+static void accumulateChunk(const double *values, int n, double noData, int hasNoData, statAccumulator *acc)
+{
+    int i, k, valid;
+    double value, d;
+    for (i = 0; i + STATSLANES <= n; i += STATSLANES)
+    {
+        for (k = 0; k < STATSLANES; k++)
+        {
+            value = values[i + k];
+            valid = isValid(value, noData, hasNoData);
+            d = valid ? value - acc->shift : 0.;
+            acc->sum[k] += d;
+            acc->sumSq[k] += d * d;
+            acc->count[k] += valid;
+            acc->min[k] = (valid && value < acc->min[k]) ? value : acc->min[k];
+            acc->max[k] = (valid && value > acc->max[k]) ? value : acc->max[k];
+        }
+    }
+    // Tail in lane 0
+    for (; i < n; i++)
+    {
+        value = values[i];
+        if (!isValid(value, noData, hasNoData))
+            continue;
+        d = value - acc->shift;
+        acc->sum[0] += d;
+        acc->sumSq[0] += d * d;
+        acc->count[0]++;
+        acc->min[0] = (value < acc->min[0]) ? value : acc->min[0];
+        acc->max[0] = (value > acc->max[0]) ? value : acc->max[0];
+    }
+}
+
+static void histogramChunk(const double *values, int n, double noData, int hasNoData, bandStatistics *stats)
+{
+    int i, bucket;
+    double scale = stats->nBuckets / (stats->histMax - stats->histMin);
+    for (i = 0; i < n; i++)
+    {
+        if (!isValid(values[i], noData, hasNoData) || values[i] < stats->histMin || values[i] > stats->histMax)
+            continue;
+        bucket = (int)((values[i] - stats->histMin) * scale);
+        stats->histogram[(bucket < stats->nBuckets) ? bucket : stats->nBuckets - 1]++;
+    }
+}
+
+// Convert pixels [offset, offset + n) of data to double.
+static void chunkToDouble(const void *data, int dataType, int64_t offset, int n, double *values)
+{
+    int dataTypeSize = GDALGetDataTypeSizeBytes(dataType);
+    GDALCopyWords((const unsigned char *)data + offset * dataTypeSize, dataType, dataTypeSize, values, GDT_Float64,
+                  sizeof(double), n);
+}
+
+/*
+  Compute statistics of the n pixels in data, ignoring NaN and noData (if hasNoData). If nBuckets > 0,
+  also compute a histogram over [histMin, histMax], or over the data range if histMin >= histMax (widened
+  by 1/2 for integer types so each integer is centered in a bucket). Free stats->histogram with CPLFree.
+  Complex types are not supported.
+*/
+void computeBandStatistics(const void *data, int64_t n, int dataType, double noData, int hasNoData, int nBuckets,
+                           double histMin, double histMax, bandStatistics *stats)
+{
+    statAccumulator acc;
+    double values[STATSCHUNK], sum = 0., sumSq = 0., variance;
+    int64_t offset;
+    int k, nChunk, histInPass;
+    //
+    memset(stats, 0, sizeof(bandStatistics));
+    stats->nPixels = n;
+    if (GDALDataTypeIsComplex(dataType))
+        error("computeBandStatistics: Complex types not supported\n");
+    memset(&acc, 0, sizeof(acc));
+    for (k = 0; k < STATSLANES; k++)
+    {
+        acc.min[k] = INFINITY;
+        acc.max[k] = -INFINITY;
+    }
+    // Shift by the first valid value
+    for (offset = 0; offset < n; offset += nChunk)
+    {
+        nChunk = (n - offset > STATSCHUNK) ? STATSCHUNK : (int)(n - offset);
+        chunkToDouble(data, dataType, offset, nChunk, values);
+        for (k = 0; k < nChunk && !isValid(values[k], noData, hasNoData); k++);
+        if (k < nChunk)
+        {
+            acc.shift = values[k];
+            break;
+        }
+    }
+    // Histogram in the same pass if the range is known
+    if (nBuckets > 0)
+    {
+        stats->nBuckets = nBuckets;
+        stats->histogram = (GUIntBig *)CPLCalloc(nBuckets, sizeof(GUIntBig));
+    }
+    histInPass = nBuckets > 0 && histMin < histMax;
+    if (histInPass)
+    {
+        stats->histMin = histMin;
+        stats->histMax = histMax;
+    }
+    for (; offset < n; offset += nChunk)
+    {
+        nChunk = (n - offset > STATSCHUNK) ? STATSCHUNK : (int)(n - offset);
+        chunkToDouble(data, dataType, offset, nChunk, values);
+        accumulateChunk(values, nChunk, noData, hasNoData, &acc);
+        if (histInPass)
+            histogramChunk(values, nChunk, noData, hasNoData, stats);
+    }
+    // Combine the lanes
+    stats->min = INFINITY;
+    stats->max = -INFINITY;
+    for (k = 0; k < STATSLANES; k++)
+    {
+        sum += acc.sum[k];
+        sumSq += acc.sumSq[k];
+        stats->nValid += acc.count[k];
+        stats->min = (acc.min[k] < stats->min) ? acc.min[k] : stats->min;
+        stats->max = (acc.max[k] > stats->max) ? acc.max[k] : stats->max;
+    }
+    if (stats->nValid == 0)
+    {
+        stats->min = stats->max = 0.;
+        return;
+    }
+    stats->mean = acc.shift + sum / stats->nValid;
+    variance = (sumSq - sum * sum / stats->nValid) / stats->nValid;
+    stats->stdDev = (variance > 0.) ? sqrt(variance) : 0.;
+    // Histogram over the data range
+    if (nBuckets > 0 && !histInPass)
+    {
+        stats->histMin = stats->min;
+        stats->histMax = stats->max;
+        if (GDALDataTypeIsInteger(dataType) || stats->histMin == stats->histMax)
+        {
+            stats->histMin -= 0.5;
+            stats->histMax += 0.5;
+        }
+        for (offset = 0; offset < n; offset += nChunk)
+        {
+            nChunk = (n - offset > STATSCHUNK) ? STATSCHUNK : (int)(n - offset);
+            chunkToDouble(data, dataType, offset, nChunk, values);
+            histogramChunk(values, nChunk, noData, hasNoData, stats);
+        }
+    }
+}
+
+/*
+  Store stats as the band's STATISTICS_* metadata (carried into tiffs by CreateCopy). Nothing is stored
+  for bands without valid pixels.
+*/
+void setBandStatistics(GDALRasterBandH band, bandStatistics *stats)
+{
+    char buf[64];
+    if (stats->nValid == 0)
+        return;
+    GDALSetRasterStatistics(band, stats->min, stats->max, stats->mean, stats->stdDev);
+    sprintf(buf, "%.6g", 100. * stats->nValid / (double)stats->nPixels);
+    GDALSetMetadataItem(band, "STATISTICS_VALID_PERCENT", buf, NULL);
+}
+
+/*
+  Store the histogram as the band's default histogram. For tiffs this goes in the .aux.xml, so band
+  must belong to the output data set rather than the MEM source.
+*/
+void setBandHistogram(GDALRasterBandH band, bandStatistics *stats)
+{
+    if (stats->histogram == NULL || stats->nValid == 0)
+        return;
+    if (GDALSetDefaultHistogramEx(band, stats->histMin, stats->histMax, stats->nBuckets, stats->histogram) != CE_None)
+    {
+        ioStatsLog("setBandHistogram: Could not store histogram\n");
+        CPLErrorReset(); // Not a failure of the write
+    }
+}
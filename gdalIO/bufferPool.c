@@ -0,0 +1,226 @@
+#include <pthread.h>
+#include <sys/mman.h>
+#include "gdalIO/gdalIO/grimpgdal.h"
+#include "mosaicSource/common/common.h"
+
+/*
+  Pool of raster buffers for the readers. Sizes are 64 bit. Buffers of 2 MB or more are 2 MB aligned,
+  rounded to whole 2 MB pages, and flagged for transparent huge pages, which cuts first-touch page
+  faults by a factor of 512. Buffers returned with releaseData are kept for reuse by the next request of
+  the same rounded size (e.g., successive readRasterVRTPooled calls on same-sized products), up to
+  GRIMPIO_POOL_MB (default 1024) MB of idle memory. Buffers from the pool (allocBuffer, and the readers
+  documented to use it) must be returned with releaseData. Each has a header in front of it naming its
+  pool entry, so releaseData only takes back buffers whose address and header both match, and frees
+  anything else. Pool buffers are not the start of an allocation, so free/CPLFree on one fails rather
+  than leaving the pool holding memory it no longer owns.
+*/
+
+#define POOLPAGE (2 * 1024 * 1024)
+#define POOLSMALLALIGN 64
+// Bytes in front of each buffer, keeping it POOLSMALLALIGN aligned
+#define POOLHEADER POOLSMALLALIGN
+#define POOLMAGIC 0x47724950506f6f6cULL
+// Set in every tag, so the tag never reads as a valid allocation size
+#define POOLTAGBITS 0xf000000000000008ULL
+
+// Ends the POOLHEADER bytes in front of a buffer
+typedef struct poolHeader {
+    uint64_t magic; // POOLMAGIC ^ buffer address
+    uint64_t tag;   // Tag of the buffer's entry
+} poolHeader;
+
+typedef struct poolEntry {
+    void *data;
+    void *base; // Allocation holding the header and data
+    size_t size; // Rounded size
+    uint64_t tag;
+    int inUse;
+    uint64_t lastUsed;
+} poolEntry;
+
+static poolEntry *entries = NULL;
+static int nEntries = 0, maxEntries = 0;
+static int64_t idleBytes = 0, maxIdleBytes = -1;
+static uint64_t useTick = 0, nextTag = 0;
+static pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Called with the mutex held.
+static int64_t getMaxIdleBytes()
+{
+    const char *env;
+    if (maxIdleBytes < 0)
+    {
+        env = getenv("GRIMPIO_POOL_MB");
+        maxIdleBytes = ((env != NULL && atoll(env) >= 0) ? atoll(env) : 1024) * 1024 * 1024;
+    }
+    return maxIdleBytes;
+}
+
+static size_t roundedSize(size_t nBytes)
+{
+    if (nBytes >= POOLPAGE)
+        return (nBytes + POOLPAGE - 1) / POOLPAGE * POOLPAGE;
+    return (nBytes + POOLSMALLALIGN - 1) / POOLSMALLALIGN * POOLSMALLALIGN;
+}
+
+static void removeEntry(int i)
+{
+    entries[i] = entries[--nEntries];
+}
+
+static poolHeader *headerOf(void *data)
+{
+    return (poolHeader *)((char *)data - sizeof(poolHeader));
+}
+
+/*
+  Entry for a pool buffer, -1 for any other pointer, or -2 for a pool buffer whose header was
+  overwritten (which is kept rather than freed). Called with the mutex held.
+*/
+static int findEntry(void *data)
+{
+    poolHeader *header;
+    int i;
+    for (i = 0; i < nEntries; i++)
+    {
+        if (entries[i].data == data)
+        {
+            // The address is a live pool buffer, so its header can be read
+            header = headerOf(data);
+            if (header->magic == (POOLMAGIC ^ (uint64_t)(uintptr_t)data) && header->tag == entries[i].tag)
+                return i;
+            fprintf(stderr, "releaseData: Pool buffer %p has a damaged header\n", data);
+            return -2;
+        }
+    }
+    return -1;
+}
+
+/*
+  Free idle buffers, least recently used first, until at most limit bytes are idle. Buffers to free
+  are returned in toFree so they are freed without the mutex. Called with the mutex held.
+*/
+static int trimIdle(int64_t limit, void **toFree, int maxFree)
+{
+    int i, lru, nFree = 0;
+    while (idleBytes > limit && nFree < maxFree)
+    {
+        lru = -1;
+        for (i = 0; i < nEntries; i++)
+            if (entries[i].inUse == FALSE && (lru < 0 || entries[i].lastUsed < entries[lru].lastUsed))
+                lru = i;
+        if (lru < 0)
+            break;
+        idleBytes -= entries[lru].size;
+        toFree[nFree++] = entries[lru].base;
+        removeEntry(lru);
+    }
+    return nFree;
+}
+
+/*
+  Get a buffer of at least nBytes, reusing an idle one of the same rounded size if possible. New
+  buffers are counted against function in the I/O statistics. Return it with releaseData.
+*/
+void *allocBuffer(size_t nBytes, const char *function)
+{
+    size_t size = roundedSize(nBytes > 0 ? nBytes : 1);
+    poolHeader *header;
+    void *base = NULL, *data = NULL;
+    int i;
+    //
+    pthread_mutex_lock(&poolMutex);
+    for (i = 0; i < nEntries; i++)
+    {
+        if (entries[i].inUse == FALSE && entries[i].size == size)
+        {
+            entries[i].inUse = TRUE;
+            entries[i].lastUsed = ++useTick;
+            idleBytes -= size;
+            data = entries[i].data;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&poolMutex);
+    if (data != NULL)
+    {
+        ioStatsLog("%s: reusing %lld bytes\n", function, (long long)size);
+        return data;
+    }
+    // New buffer
+    if (posix_memalign(&base, (size >= POOLPAGE) ? POOLPAGE : POOLSMALLALIGN, size + POOLHEADER) != 0)
+        error("%s: Could not allocate %lld bytes\n", function, (long long)size);
+#ifdef MADV_HUGEPAGE
+    if (size >= POOLPAGE)
+        madvise(base, size + POOLHEADER, MADV_HUGEPAGE);
+#endif
+    ioStatsAlloc(function, (int64_t)size);
+    data = (char *)base + POOLHEADER;
+    header = headerOf(data);
+    header->magic = POOLMAGIC ^ (uint64_t)(uintptr_t)data;
+    pthread_mutex_lock(&poolMutex);
+    if (nEntries == maxEntries)
+    {
+        maxEntries = (maxEntries == 0) ? 16 : 2 * maxEntries;
+        entries = (poolEntry *)CPLRealloc(entries, sizeof(poolEntry) * maxEntries);
+    }
+    header->tag = POOLTAGBITS | (++nextTag << 4);
+    entries[nEntries].data = data;
+    entries[nEntries].base = base;
+    entries[nEntries].size = size;
+    entries[nEntries].tag = header->tag;
+    entries[nEntries].inUse = TRUE;
+    entries[nEntries].lastUsed = ++useTick;
+    nEntries++;
+    pthread_mutex_unlock(&poolMutex);
+    return data;
+}
+
+/*
+  Return a buffer from allocBuffer (or any reader documented to use it) to the pool. Other buffers
+  (e.g., from allocData or readRasterVRT) are freed.
+*/
+void releaseData(void *data)
+{
+    void *toFree[16];
+    int i, nFree = 0, found;
+    //
+    if (data == NULL)
+        return;
+    pthread_mutex_lock(&poolMutex);
+    if ((found = findEntry(data)) >= 0)
+    {
+        if (entries[found].inUse == TRUE)
+        {
+            entries[found].inUse = FALSE;
+            entries[found].lastUsed = ++useTick;
+            idleBytes += entries[found].size;
+        }
+        else
+            ioStatsLog("releaseData: Pool buffer %p was already released\n", data);
+    }
+    nFree = trimIdle(getMaxIdleBytes(), toFree, 16);
+    pthread_mutex_unlock(&poolMutex);
+    if (found == -1)
+        free(data);
+    for (i = 0; i < nFree; i++)
+        free(toFree[i]);
+}
+
+// Set the most idle memory kept for reuse (0 disables reuse), freeing any excess.
+void setBufferPoolSize(int64_t maxBytes)
+{
+    void *toFree[16];
+    int i, nFree;
+    pthread_mutex_lock(&poolMutex);
+    maxIdleBytes = (maxBytes < 0) ? 0 : maxBytes;
+    pthread_mutex_unlock(&poolMutex);
+    do
+    {
+        pthread_mutex_lock(&poolMutex);
+        nFree = trimIdle(maxIdleBytes, toFree, 16);
+        pthread_mutex_unlock(&poolMutex);
+        for (i = 0; i < nFree; i++)
+            free(toFree[i]);
+    } while (nFree == 16);
+}
@@ -0,0 +1,179 @@
+#include "gdalIO/gdalIO/grimpgdal.h"
+#include "mosaicSource/common/common.h"
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define SWAPSIMD 1
+#endif
+
+/*
+  Byte swap kernels for all GDAL data types. Complex types are swapped as two words per pixel.
+  Swaps can be in place (src == dst) or from a source array into a separate (e.g., staging) buffer.
+  On x86_64, AVX2 or SSSE3 shuffles are selected at run time, with a scalar fallback elsewhere.
+*/
+
+// Byte shuffle masks reversing each 2, 4, or 8 byte word in a 16 byte lane
+static const uint8_t swapMask2[16] = {1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14};
+static const uint8_t swapMask4[16] = {3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12};
+static const uint8_t swapMask8[16] = {7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8};
+
+// Scalar swap of nWords words of wordSize bytes, which also handles the SIMD tails.
+static void swapWordsScalar(const uint8_t *src, uint8_t *dst, size_t nWords, int wordSize)
+{
+    size_t i;
+    uint16_t w2;
+    uint32_t w4;
+    uint64_t w8;
+    // memcpy keeps unaligned buffers legal and compiles to plain loads/stores
+    switch (wordSize)
+    {
+    case 2:
+        for (i = 0; i < nWords; i++)
+        {
+            memcpy(&w2, src + 2 * i, 2);
+            w2 = __builtin_bswap16(w2);
+            memcpy(dst + 2 * i, &w2, 2);
+        }
+        break;
+    case 4:
+        for (i = 0; i < nWords; i++)
+        {
+            memcpy(&w4, src + 4 * i, 4);
+            w4 = __builtin_bswap32(w4);
+            memcpy(dst + 4 * i, &w4, 4);
+        }
+        break;
+    case 8:
+        for (i = 0; i < nWords; i++)
+        {
+            memcpy(&w8, src + 8 * i, 8);
+            w8 = __builtin_bswap64(w8);
+            memcpy(dst + 8 * i, &w8, 8);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+#ifdef SWAPSIMD
+static const uint8_t *swapMask(int wordSize)
+{
+    return (wordSize == 2) ? swapMask2 : ((wordSize == 4) ? swapMask4 : swapMask8);
+}
+
+__attribute__((target("ssse3"))) static size_t swapBytesSSSE3(const uint8_t *src, uint8_t *dst, size_t nBytes,
+                                                                int wordSize)
+{
+    size_t i;
+    __m128i mask = _mm_loadu_si128((const __m128i *)swapMask(wordSize));
+    for (i = 0; i + 16 <= nBytes; i += 16)
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i)), mask));
+    return i;
+}
+
+__attribute__((target("avx2"))) static size_t swapBytesAVX2(const uint8_t *src, uint8_t *dst, size_t nBytes,
+                                                              int wordSize)
+{
+    size_t i;
+    __m256i mask = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)swapMask(wordSize)));
+    // Two vectors per iteration to keep both load ports busy
+    for (i = 0; i + 64 <= nBytes; i += 64)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + i + 32));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_shuffle_epi8(a, mask));
+        _mm256_storeu_si256((__m256i *)(dst + i + 32), _mm256_shuffle_epi8(b, mask));
+    }
+    for (; i + 32 <= nBytes; i += 32)
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(src + i)), mask));
+    return i;
+}
+
+// 2 for AVX2, 1 for SSSE3, 0 for scalar
+static int swapSIMDLevel()
+{
+    static int level = -1;
+    if (level < 0)
+    {
+        __builtin_cpu_init();
+        level = __builtin_cpu_supports("avx2") ? 2 : (__builtin_cpu_supports("ssse3") ? 1 : 0);
+    }
+    return level;
+}
+#endif
+
+// Size in bytes of the words to be swapped for dataType (0 if no swap is needed).
+int byteSwapWordSize(int dataType)
+{
+    switch (dataType)
+    {
+    case GDT_Byte:
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3, 7, 0)
+    case GDT_Int8:
+#endif
+        return 0;
+    case GDT_UInt16:
+    case GDT_Int16:
+    case GDT_CInt16:
+        return 2;
+    case GDT_UInt32:
+    case GDT_Int32:
+    case GDT_Float32:
+    case GDT_CInt32:
+    case GDT_CFloat32:
+        return 4;
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3, 5, 0)
+    case GDT_UInt64:
+    case GDT_Int64:
+#endif
+    case GDT_Float64:
+    case GDT_CFloat64:
+        return 8;
+    default:
+        error("Invalid data type in byte swap %i", dataType);
+    }
+    return 0;
+}
+
+/*
+  Swap size pixels of dataType from src into dst (which may be src). For byte types this is a copy.
+*/
+void *byteSwapCopy(const void *src, void *dst, int dataType, int64_t size)
+{
+    int wordSize = byteSwapWordSize(dataType);
+    size_t nWords, nBytes, done = 0;
+    //
+    if (wordSize == 0)
+    {
+        if (dst != src)
+            memcpy(dst, src, (size_t)size * GDALGetDataTypeSizeBytes(dataType));
+        return dst;
+    }
+    // Complex types have two words per pixel
+    nWords = (size_t)size * (GDALDataTypeIsComplex(dataType) ? 2 : 1);
+    nBytes = nWords * wordSize;
+#ifdef SWAPSIMD
+    switch (swapSIMDLevel())
+    {
+    case 2:
+        done = swapBytesAVX2((const uint8_t *)src, (uint8_t *)dst, nBytes, wordSize);
+        break;
+    case 1:
+        done = swapBytesSSSE3((const uint8_t *)src, (uint8_t *)dst, nBytes, wordSize);
+        break;
+    default:
+        break;
+    }
+#endif
+    swapWordsScalar((const uint8_t *)src + done, (uint8_t *)dst + done, (nBytes - done) / wordSize, wordSize);
+    return dst;
+}
+
+/*
+  Swap size pixels of buffer in place.
+*/
+void *byteSwapData(void *buffer, int dataType, int64_t size)
+{
+    return byteSwapCopy(buffer, buffer, dataType, size);
+}
@@ -0,0 +1,209 @@
+#include <pthread.h>
+#include "gdalIO/gdalIO/grimpgdal.h"
+#include "mosaicSource/common/common.h"
+
+/*
+  Bounded LRU cache of read-only GDAL data set handles keyed by path. acquireDataSet returns a handle
+  for the exclusive use of the caller (GDAL handles are not safe to share between threads) until
+  releaseDataSet, after which it stays open for reuse. A path can have several handles if it is
+  acquired concurrently. Idle handles beyond the cache size are closed least recently used first, and
+  handles are reopened if the file has changed since it was opened.
+  The default size is 32, or GRIMPIO_MAX_OPEN if set.
+*/
+
+typedef struct dataSetEntry {
+    char *fileName;
+    GDALDatasetH hDS;
+    int inUse;
+    uint64_t lastUsed;
+    int64_t mtime, size; // File state when opened
+} dataSetEntry;
+
+static dataSetEntry *entries = NULL;
+static int nEntries = 0, maxEntries = 0, cacheSize = -1;
+static uint64_t useTick = 0;
+static pthread_mutex_t cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Called with the mutex held.
+static int getCacheSize()
+{
+    const char *env;
+    if (cacheSize < 0)
+    {
+        env = getenv("GRIMPIO_MAX_OPEN");
+        cacheSize = (env != NULL && atoi(env) >= 0) ? atoi(env) : 32;
+    }
+    return cacheSize;
+}
+
+static void fileState(const char *fileName, int64_t *mtime, int64_t *size)
+{
+    VSIStatBufL stat;
+    if (VSIStatL(fileName, &stat) == 0)
+    {
+        *mtime = (int64_t)stat.st_mtime;
+        *size = (int64_t)stat.st_size;
+    }
+    else
+        *mtime = *size = -1;
+}
+
+static void removeEntry(int i, GDALDatasetH *toClose, int *nClose)
+{
+    toClose[(*nClose)++] = entries[i].hDS;
+    CPLFree(entries[i].fileName);
+    entries[i] = entries[--nEntries];
+}
+
+/*
+  Remove idle entries, least recently used first, until the cache is within size. Handles to close are
+  returned in toClose so they can be closed without holding the mutex. Called with the mutex held.
+*/
+static void evictIdle(GDALDatasetH *toClose, int *nClose, int maxClose)
+{
+    int i, lru;
+    while (nEntries > getCacheSize() && *nClose < maxClose)
+    {
+        lru = -1;
+        for (i = 0; i < nEntries; i++)
+            if (entries[i].inUse == FALSE && (lru < 0 || entries[i].lastUsed < entries[lru].lastUsed))
+                lru = i;
+        if (lru < 0)
+            return;
+        removeEntry(lru, toClose, nClose);
+    }
+}
+
+static void closeAll(GDALDatasetH *toClose, int nClose)
+{
+    int i;
+    for (i = 0; i < nClose; i++)
+    {
+        double t0 = ioStatsStart();
+        GDALClose(toClose[i]);
+        ioStatsStop("acquireDataSet", IOSTAT_CLOSE, t0, 0);
+    }
+}
+
+/*
+  Get a read-only handle for fileName, from the cache if possible. Return it with releaseDataSet.
+*/
+GDALDatasetH acquireDataSet(const char *fileName)
+{
+    GDALDatasetH hDS = NULL, toClose[8];
+    int64_t mtime, size;
+    int i, nClose = 0;
+    //
+    fileState(fileName, &mtime, &size);
+    pthread_mutex_lock(&cacheMutex);
+    for (i = 0; i < nEntries; i++)
+    {
+        if (entries[i].inUse == TRUE || strcmp(entries[i].fileName, fileName) != 0)
+            continue;
+        // Stale, so drop it
+        if (entries[i].mtime != mtime || entries[i].size != size)
+        {
+            removeEntry(i--, toClose, &nClose);
+            if (nClose == 8)
+                break;
+            continue;
+        }
+        entries[i].inUse = TRUE;
+        entries[i].lastUsed = ++useTick;
+        hDS = entries[i].hDS;
+        break;
+    }
+    pthread_mutex_unlock(&cacheMutex);
+    closeAll(toClose, nClose);
+    if (hDS != NULL)
+        return hDS;
+    // Open outside the lock
+    double t0 = ioStatsStart();
+    hDS = GDALOpen(fileName, GA_ReadOnly);
+    if (hDS == NULL)
+        return NULL;
+    ioStatsStop("acquireDataSet", IOSTAT_OPEN, t0, 0);
+    nClose = 0;
+    pthread_mutex_lock(&cacheMutex);
+    if (nEntries == maxEntries)
+    {
+        maxEntries = (maxEntries == 0) ? 16 : 2 * maxEntries;
+        entries = (dataSetEntry *)CPLRealloc(entries, sizeof(dataSetEntry) * maxEntries);
+    }
+    entries[nEntries].fileName = CPLStrdup(fileName);
+    entries[nEntries].hDS = hDS;
+    entries[nEntries].inUse = TRUE;
+    entries[nEntries].lastUsed = ++useTick;
+    entries[nEntries].mtime = mtime;
+    entries[nEntries].size = size;
+    nEntries++;
+    evictIdle(toClose, &nClose, 8);
+    pthread_mutex_unlock(&cacheMutex);
+    closeAll(toClose, nClose);
+    return hDS;
+}
+
+/*
+  Return a handle from acquireDataSet to the cache. Handles not from the cache are closed.
+*/
+void releaseDataSet(GDALDatasetH hDS)
+{
+    GDALDatasetH toClose[8];
+    int i, nClose = 0, found = FALSE;
+    //
+    if (hDS == NULL)
+        return;
+    pthread_mutex_lock(&cacheMutex);
+    for (i = 0; i < nEntries; i++)
+    {
+        if (entries[i].hDS == hDS)
+        {
+            entries[i].inUse = FALSE;
+            entries[i].lastUsed = ++useTick;
+            found = TRUE;
+            break;
+        }
+    }
+    evictIdle(toClose, &nClose, 8);
+    pthread_mutex_unlock(&cacheMutex);
+    if (found == FALSE)
+        toClose[nClose++] = hDS;
+    closeAll(toClose, nClose);
+}
+
+/*
+  Drop idle handles for fileName (e.g., after it is rewritten), or all idle handles if fileName is NULL.
+*/
+void invalidateDataSet(const char *fileName)
+{
+    GDALDatasetH toClose[8];
+    int i, nClose;
+    do
+    {
+        nClose = 0;
+        pthread_mutex_lock(&cacheMutex);
+        for (i = 0; i < nEntries && nClose < 8; i++)
+            if (entries[i].inUse == FALSE && (fileName == NULL || strcmp(entries[i].fileName, fileName) == 0))
+                removeEntry(i--, toClose, &nClose);
+        pthread_mutex_unlock(&cacheMutex);
+        closeAll(toClose, nClose);
+    } while (nClose == 8);
+}
+
+// Set the maximum number of idle handles kept open (0 disables caching).
+void setDataSetCacheSize(int size)
+{
+    GDALDatasetH toClose[8];
+    int nClose;
+    pthread_mutex_lock(&cacheMutex);
+    cacheSize = (size < 0) ? 0 : size;
+    pthread_mutex_unlock(&cacheMutex);
+    do
+    {
+        nClose = 0;
+        pthread_mutex_lock(&cacheMutex);
+        evictIdle(toClose, &nClose, 8);
+        pthread_mutex_unlock(&cacheMutex);
+        closeAll(toClose, nClose);
+    } while (nClose == 8);
+}
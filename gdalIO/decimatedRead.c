@@ -0,0 +1,128 @@
+#include <math.h>
+#include "gdal.h"
+#include "gdalIO/gdalIO/grimpgdal.h"
+#include "mosaicSource/common/common.h"
+
+/*
+  Reduced resolution reads for quick looks, QA, and coarse registration. If the band has overviews
+  (e.g., COGs), GDAL reads from the closest overview with average resampling, so the I/O scales with
+  the output size. Otherwise the band is streamed in strips of the input rows for each output row,
+  and box averaged, ignoring nodata and NaN, so memory is bounded by one strip.
+*/
+
+// Streaming box average of hBand into data (outXSize x outYSize of dataType).
+static void decimateByStrips(GDALRasterBandH hBand, int xSize, int ySize, void *data, int outXSize, int outYSize,
+                             int dataType, double noData, int hasNoData)
+{
+    double *strip, *sum, *count, outNoData, value;
+    int *column, x, y, j, y0, y1, maxRows;
+    int dataTypeSize = GDALGetDataTypeSizeBytes(dataType);
+    CPLErr status;
+    //
+    // Output column of each input column, and the most input rows for an output row
+    column = (int *)CPLMalloc(sizeof(int) * xSize);
+    for (x = 0; x < xSize; x++)
+        column[x] = (int)((int64_t)x * outXSize / xSize);
+    maxRows = (ySize + outYSize - 1) / outYSize;
+    strip = (double *)allocBuffer(sizeof(double) * xSize * (size_t)maxRows, "readRasterDecimated");
+    sum = (double *)CPLMalloc(sizeof(double) * outXSize);
+    count = (double *)CPLMalloc(sizeof(double) * outXSize);
+    // Empty cells get nodata (NaN, or 0 for integers, if the band has none)
+    outNoData = hasNoData ? noData : (GDALDataTypeIsFloating(dataType) ? NAN : 0.);
+    for (j = 0; j < outYSize; j++)
+    {
+        // Input rows [y0, y1) map to output row j
+        y0 = (int)(((int64_t)j * ySize + outYSize - 1) / outYSize);
+        y1 = (int)(((int64_t)(j + 1) * ySize + outYSize - 1) / outYSize);
+        if (y1 > ySize)
+            y1 = ySize;
+        memset(sum, 0, sizeof(double) * outXSize);
+        memset(count, 0, sizeof(double) * outXSize);
+        if (y1 > y0)
+        {
+            // GDAL converts to double as it reads
+            double t0 = ioStatsStart();
+            status = GDALRasterIO(hBand, GF_Read, 0, y0, xSize, y1 - y0, strip, xSize, y1 - y0, GDT_Float64, 0, 0);
+            ifNEReturnCode(status, CE_None, "readRasterDecimated: Could not read rows %i to %i\n", y0, y1);
+            ioStatsStop("readRasterDecimated", IOSTAT_READ, t0, (int64_t)xSize * (y1 - y0) * dataTypeSize);
+            for (y = 0; y < y1 - y0; y++)
+            {
+                for (x = 0; x < xSize; x++)
+                {
+                    value = strip[(size_t)y * xSize + x];
+                    if (isnan(value) || (hasNoData && value == noData))
+                        continue;
+                    sum[column[x]] += value;
+                    count[column[x]] += 1.;
+                }
+            }
+        }
+        for (x = 0; x < outXSize; x++)
+            sum[x] = (count[x] > 0.) ? sum[x] / count[x] : outNoData;
+        // Convert to the band type (rounding for integers)
+        GDALCopyWords(sum, GDT_Float64, sizeof(double), (unsigned char *)data + (size_t)j * outXSize * dataTypeSize,
+                      dataType, dataTypeSize, outXSize);
+    }
+    CPLFree(column);
+    releaseData(strip);
+    CPLFree(sum);
+    CPLFree(count);
+}
+
+/*
+  Read band of fileName averaged down to *outXSize x *outYSize in the band's type. If decimation > 0,
+  the output size is the input size divided by decimation (rounded up) and *outXSize and *outYSize are
+  set, otherwise they give the output size. Outputs are otherwise as for readRasterVRT, with *xSize
+  and *ySize the full resolution size. Rows are in file order. Return the result with releaseData.
+*/
+void *readRasterDecimated(char *fileName, int band, int decimation, int *outXSize, int *outYSize, int *xSize,
+                          int *ySize, int *dataType, dictNode **metaDictionary)
+{
+    GDALRasterIOExtraArg extraArg;
+    GDALRasterBandH hBand;
+    double noData;
+    int hasNoData, dataTypeSize;
+    void *data;
+    CPLErr status;
+    //
+    GDALDatasetH hDS = acquireDataSet(fileName);
+    ifNullError(hDS, "readRasterDecimated: Could not open %s\n", fileName);
+    if (band < 1 || band > GDALGetRasterCount(hDS))
+        error("readRasterDecimated: Invalid band %i for %s", band, fileName);
+    hBand = GDALGetRasterBand(hDS, band);
+    *dataType = GDALGetRasterDataType(hBand);
+    dataTypeSize = GDALGetDataTypeSizeBytes(*dataType);
+    *xSize = GDALGetRasterBandXSize(hBand);
+    *ySize = GDALGetRasterBandYSize(hBand);
+    // Output size
+    if (decimation > 0)
+    {
+        *outXSize = (*xSize + decimation - 1) / decimation;
+        *outYSize = (*ySize + decimation - 1) / decimation;
+    }
+    if (*outXSize < 1 || *outYSize < 1)
+        error("readRasterDecimated: Invalid output size %i x %i\n", *outXSize, *outYSize);
+    // No upsampling
+    *outXSize = (*outXSize > *xSize) ? *xSize : *outXSize;
+    *outYSize = (*outYSize > *ySize) ? *ySize : *outYSize;
+    data = allocBuffer((size_t)(*outXSize) * (size_t)(*outYSize) * dataTypeSize, "readRasterDecimated");
+    noData = GDALGetRasterNoDataValue(hBand, &hasNoData);
+    //
+    if (GDALGetOverviewCount(hBand) > 0 || (*outXSize == *xSize && *outYSize == *ySize))
+    {
+        // GDAL picks the overview and averages the rest of the way
+        INIT_RASTERIO_EXTRA_ARG(extraArg);
+        extraArg.eResampleAlg = GRIORA_Average;
+        double t0 = ioStatsStart();
+        status = GDALRasterIOEx(hBand, GF_Read, 0, 0, *xSize, *ySize, data, *outXSize, *outYSize, *dataType, 0, 0,
+                                &extraArg);
+        ifNEReturnCode(status, CE_None, "readRasterDecimated: Could not read band data\n");
+        ioStatsStop("readRasterDecimated", IOSTAT_READ, t0, (int64_t)(*outXSize) * (*outYSize) * dataTypeSize);
+    }
+    else
+        decimateByStrips(hBand, *xSize, *ySize, data, *outXSize, *outYSize, *dataType, noData, hasNoData);
+    if (metaDictionary != NULL)
+        readDataSetMetaData(hDS, metaDictionary);
+    releaseDataSet(hDS);
+    return data;
+}
@@ -1,5 +1,27 @@
 #include "mosaicSource/common/common.h"
 
+/*
+  Dictionaries are singly linked lists of malloc'ed nodes and strings in insertion order. For long
+  dictionaries, a dictIndex (create_dict_index) is kept beside a list: it appends in O(1) and looks up
+  keys in an insertion-ordered open addressing hash table, without changing the nodes, which are still
+  freed with free_dictionary. An index is only valid while the list is changed through it.
+*/
+
+#define DICTINITSLOTS 64
+
+typedef struct dictSlot {
+    uint64_t hash;
+    dictNode *node;
+} dictSlot;
+
+struct dictIndex {
+    dictNode **head;
+    dictNode *tail;
+    dictSlot *slots; // Linear probing
+    size_t nSlots, count;
+    int unindexed;   // The table could not grow, so lookups scan the list
+};
+
 dictNode* create_node(char *key, char *value) {
     dictNode *new_node = malloc(sizeof(dictNode));
     if (new_node == NULL) {
@@ -53,4 +75,117 @@ void printDictionary(dictNode *head) {
         fprintf(stderr,"\tKey %s  Value %s\n", current->key, current->value);
     }
 
-}
\ No newline at end of file
+}
+
+// FNV-1a
+static uint64_t hashKey(const char *key)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *key != '\0'; key++)
+        hash = (hash ^ (uint8_t)*key) * 1099511628211ULL;
+    return hash;
+}
+
+// Find the slot for key, which is either empty or holds the first node with key.
+static dictSlot *findSlot(dictIndex *index, const char *key, uint64_t hash)
+{
+    size_t i = hash & (index->nSlots - 1);
+    while (index->slots[i].node != NULL &&
+           (index->slots[i].hash != hash || strcmp(index->slots[i].node->key, key) != 0))
+        i = (i + 1) & (index->nSlots - 1);
+    return &index->slots[i];
+}
+
+// Double the table. On failure the index is left unchanged.
+static int growSlots(dictIndex *index)
+{
+    dictIndex grown = *index;
+    size_t i;
+    grown.nSlots = (index->nSlots == 0) ? DICTINITSLOTS : 2 * index->nSlots;
+    grown.slots = calloc(grown.nSlots, sizeof(dictSlot));
+    if (grown.slots == NULL)
+        return -1;
+    for (i = 0; i < index->nSlots; i++)
+        if (index->slots[i].node != NULL)
+            *findSlot(&grown, index->slots[i].node->key, index->slots[i].hash) = index->slots[i];
+    free(index->slots);
+    index->slots = grown.slots;
+    index->nSlots = grown.nSlots;
+    return 0;
+}
+
+// Index the first occurrence of node's key, matching the list search order.
+static void indexNode(dictIndex *index, dictNode *node)
+{
+    dictSlot *slot;
+    uint64_t hash;
+    if (index->unindexed)
+        return;
+    if (10 * (index->count + 1) > 7 * index->nSlots && growSlots(index) != 0) {
+        // Out of memory, so fall back to list scans rather than miss this node
+        index->unindexed = 1;
+        return;
+    }
+    hash = hashKey(node->key);
+    slot = findSlot(index, node->key, hash);
+    if (slot->node == NULL) {
+        slot->hash = hash;
+        slot->node = node;
+        index->count++;
+    }
+}
+
+/*
+  Index the dictionary *head (possibly empty), which is then appended to with dict_index_insert and
+  searched with dict_index_get_value. Free with free_dict_index (the list is unchanged). Returns NULL
+  if out of memory.
+*/
+dictIndex *create_dict_index(dictNode **head) {
+    dictIndex *index = calloc(1, sizeof(dictIndex));
+    dictNode *node;
+    if (index == NULL) {
+        return NULL;
+    }
+    index->head = head;
+    if (growSlots(index) != 0) {
+        index->unindexed = 1;
+    }
+    for (node = *head; node != NULL; node = node->next) {
+        indexNode(index, node);
+        index->tail = node;
+    }
+    return index;
+}
+
+// As insert_node, without walking the list.
+void dict_index_insert(dictIndex *index, char *key, char *value) {
+    dictNode *new_node = create_node(key, value);
+    if (new_node == NULL) {
+        return;
+    }
+    if (index->tail == NULL) {
+        *index->head = new_node;
+    } else {
+        index->tail->next = new_node;
+    }
+    index->tail = new_node;
+    indexNode(index, new_node);
+}
+
+// As get_value, hashed.
+char *dict_index_get_value(dictIndex *index, char *key) {
+    dictSlot *slot;
+    if (index->unindexed) {
+        return get_value(*index->head, key);
+    }
+    slot = findSlot(index, key, hashKey(key));
+    return (slot->node != NULL) ? slot->node->value : NULL;
+}
+
+void free_dict_index(dictIndex *index) {
+    if (index == NULL) {
+        return;
+    }
+    free(index->slots);
+    free(index);
+}
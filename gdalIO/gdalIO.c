@@ -21,14 +21,12 @@ void ifNEReturnCode(CPLErr returnCode, int code, char *msg, ...)
 }
 
 
+// Buffer for a width x height raster (sized in 64 bits). Free it with CPLFree (or releaseData).
 void *allocData(int data_type, int width, int height)
 {
-  void *data = NULL;
-  void **image;
-  int size, i;
-  size = GDALGetDataTypeSize(data_type) / 8;
-  fprintf(stderr, "Mallocing %i, %i, %i %i\n", width, height, (int)size, width * height * size);
-  return CPLMalloc(width * height * size);
+  size_t size = GDALGetDataTypeSizeBytes(data_type);
+  ioStatsLog("Mallocing %i, %i, %i %lld\n", width, height, (int)size, (long long)(size * width * height));
+  return CPLMalloc(size * (size_t)width * (size_t)height);
 }
 
 char *parseNameValue(char *metaBuf, char **value)
@@ -53,18 +51,25 @@ int readDataSetMetaData(GDALDatasetH dataSet, dictNode **metaDictionary)
 {
   int i;
   char *key, *value;
+  dictIndex *index;
   // GDALRasterBandH hBand = GDALGetRasterBand(dataSet, band);
   char **metadata = GDALGetMetadata(dataSet, NULL);
   // If not meta data return.
   if(metadata == NULL) return 0;
-  // Unpack meta data
+  // Append through an index, so long lists are built without walking them
+  index = create_dict_index(metaDictionary);
+  ifNullError(index, "readDataSetMetaData: Could not index metadata\n");
+  // Unpack meta data (without modifying the list, which belongs to a possibly cached data set)
   for (i = 0; metadata[i] != NULL; i++)
   {
-    fprintf(stderr, "%s\n", metadata[i]);
-    key = parseNameValue(metadata[i], &value);
+    ioStatsLog("%s\n", metadata[i]);
+    value = (char *)CPLParseNameValue(metadata[i], &key);
     // fprintf(stderr, "key %s value %s\n", key, value);
-    insert_node(metaDictionary, key, value);
+    if (key != NULL && value != NULL)
+      dict_index_insert(index, key, value);
+    CPLFree(key);
   }
+  free_dict_index(index);
 }
 
 char *extract_filename(char *path)
@@ -88,8 +93,10 @@ char *extract_filename(char *path)
 char *checkForVrt(char *filename, char *vrtBuff)
 {
   char *vrtFile;
+  VSIStatBufL statBuf;
   vrtFile = appendSuffix(filename, ".vrt", vrtBuff);
-  if (access(vrtFile, F_OK) == 0)
+  // VSIStatL so in-memory (/vsimem/) products are found too
+  if (VSIStatL(vrtFile, &statBuf) == 0)
   {
     return vrtFile;
   }
@@ -168,52 +175,27 @@ int makeVRT(char *vrtFile, int xSize, int ySize, int dataType, char **bandNames,
   GDALClose(vrtDataset);
 }
 
-void *byteSwapData(void *buffer, int dataType, int64_t size)
+/*
+Write buffer byte swapped, one strip at a time through a small cache-resident staging buffer,
+so the caller's buffer is left unchanged.
+*/
+static CPLErr writeByteSwappedStrips(GDALRasterBandH hBand, const void *buffer, int xSize, int ySize, int dataType)
 {
-  uint16_t *buffer2Byte = NULL;
-  uint32_t *buffer4Byte = NULL;
-  uint64_t *buffer8Byte = NULL;
-  uint64_t i;
-  uint64_t correctedSize = size;
-
-  // Double the size for complex values
-  if (dataType == GDT_CInt16 || dataType == GDT_CInt32 ||
-      dataType == GDT_CFloat32 || dataType == GDT_CFloat64)
-  {
-    correctedSize = size * 2;
-  }
-  // fprintf(stderr, "%li \n", correctedSize);
-  //  Now remap the data
-  switch (dataType)
+  size_t rowBytes = (size_t)xSize * GDALGetDataTypeSizeBytes(dataType);
+  int stripRows, row, nRows;
+  void *staging;
+  CPLErr eErr = CE_None;
+  //
+  stripRows = (rowBytes >= SWAPSTAGINGBYTES) ? 1 : (int)(SWAPSTAGINGBYTES / rowBytes);
+  staging = CPLMalloc(rowBytes * stripRows);
+  for (row = 0; row < ySize && eErr == CE_None; row += stripRows)
   {
-  case GDT_Byte:
-    break;
-  case GDT_UInt16:
-  case GDT_Int16:
-    // fprintf(stderr, "byteswap 2\n");
-    buffer2Byte = (uint16_t *)buffer;
-    for (i = 0; i < size; i++)
-      CPL_SWAP32PTR(&buffer2Byte[i]);
-    break;
-  case GDT_Float32:
-  case GDT_Int32:
-  case GDT_UInt32:
-    // fprintf(stderr, "byteswap 4\n");
-    buffer4Byte = (uint32_t *)buffer;
-    for (i = 0; i < size; i++)
-      CPL_SWAP32PTR(&buffer4Byte[i]);
-    break;
-  case GDT_Float64:
-  case GDT_CFloat64:
-    // fprintf(stderr, "byteswap 8\n");
-    buffer8Byte = (uint64_t *)buffer;
-    for (i = 0; i < size; i++)
-      CPL_SWAP64PTR(&buffer8Byte[i]);
-    break;
-  default:
-    error("Invalid data type in byte swap %i", dataType);
+    nRows = (row + stripRows > ySize) ? ySize - row : stripRows;
+    byteSwapCopy((const char *)buffer + row * rowBytes, staging, dataType, (int64_t)xSize * nRows);
+    eErr = GDALRasterIO(hBand, GF_Write, 0, row, xSize, nRows, staging, xSize, nRows, dataType, 0, 0);
   }
-  return buffer;
+  CPLFree(staging);
+  return eErr;
 }
 
 // double *geoTransform, int byteSwap
@@ -225,39 +207,54 @@ int writeRasterAsVRT(void *buffer, char *fileName, int xSize, int ySize, int dat
   GDALDriverH driver = GDALGetDriverByName("ENVI");
   ifNullError(driver, "writeRasterAsVRT: Error getting driver");          
   // Opent the data set
+  double t0 = ioStatsStart();
   GDALDatasetH outputDataset = GDALCreate(driver, fileName, xSize, ySize,
                                         band, dataType, NULL);
   ifNullError(outputDataset, "writeRasterAsVRT: Error creating data set");                                        
+  ioStatsStop("writeRasterAsVRT", IOSTAT_OPEN, t0, 0);
   // Get the first raster band
   GDALRasterBandH hBand = GDALGetRasterBand(outputDataset, band);
   // Write the data
+  CPLErr eErr;
+  t0 = ioStatsStart();
   if (byteSwap == TRUE)
-    buffer = byteSwapData(buffer, dataType, xSize * ySize);
-  CPLErr eErr = GDALRasterIO(hBand, GF_Write, 0, 0, xSize, ySize,
-                             buffer, xSize, ySize, dataType, 0, 0);
+    eErr = writeByteSwappedStrips(hBand, buffer, xSize, ySize, dataType);
+  else
+    eErr = GDALRasterIO(hBand, GF_Write, 0, 0, xSize, ySize,
+                        buffer, xSize, ySize, dataType, 0, 0);
   ifNEReturnCode(eErr,  CE_None, "writeRasterAsVRT: Failed to write raster data\n");
+  ioStatsStop("writeRasterAsVRT", IOSTAT_WRITE, t0, (int64_t)xSize * ySize * GDALGetDataTypeSizeBytes(dataType));
   //, geoTransform, byteSwap
-  fprintf(stderr, "Making vrt...\n");
+  ioStatsLog("Making vrt...\n");
   vrtFile = appendSuff(fileName, ".vrt", buf);
   makeVRT(vrtFile, xSize, ySize, dataType, &fileName, 1, geoTransform, byteSwap, metaData);
   // Close data set
+  t0 = ioStatsStart();
   GDALClose(outputDataset);
-  // Now make a vrt file for data set.
+  ioStatsStop("writeRasterAsVRT", IOSTAT_CLOSE, t0, 0);
+  // Drop any cached handles to the old version
+  invalidateDataSet(vrtFile);
+  invalidateDataSet(fileName);
+  return 0;
 }
 
-void **readRasterVRT(char *fileName, int band, int *xSize, int *ySize, int *dataType, dictNode **metaDictionary)
+// Read band of fileName into a new buffer (pooled FALSE) or a buffer from the pool (pooled TRUE).
+static void *readRasterBand(char *fileName, int band, int *xSize, int *ySize, int *dataType,
+                            dictNode **metaDictionary, int pooled)
 {
+  const char *function = pooled ? "readRasterVRTPooled" : "readRasterVRT";
   int nbands, i;
   int dataTypeSize, status;
   void *data;
   // Open Data set and check valid band requested
-  fprintf(stderr, "Reading %s\n", fileName);
-  GDALDatasetH hDS = GDALOpen(fileName, GDAL_OF_READONLY);
+  ioStatsLog("Reading %s\n", fileName);
+  GDALDatasetH hDS = acquireDataSet(fileName);
+  ifNullError(hDS, "readRasterVRT: Could not open %s\n", fileName);
   nbands = GDALGetRasterCount(hDS);
   if (band < 1 || band > nbands)
     error("readRasterVRT: Invalid band %i", band);
   // Get the band metadata.
-  fprintf(stderr, "BAND %i\n\n", band);
+  ioStatsLog("BAND %i\n\n", band);
   GDALRasterBandH hBand = GDALGetRasterBand(hDS, band);
   if (hBand == NULL)
     fprintf(stderr, "readRasterVRT: Could not get raster band\n");
@@ -271,12 +268,96 @@ void **readRasterVRT(char *fileName, int band, int *xSize, int *ySize, int *data
   *ySize = GDALGetRasterBandYSize(hBand);
   // fprintf(stderr, "size %i %i\n", *xSize, *ySize);
   //  Malloc data
-  data = allocData(*dataType, *xSize, *ySize);
+  if (pooled)
+    data = allocBuffer(dataTypeSize * (size_t)(*xSize) * (size_t)(*ySize), function);
+  else
+  {
+    data = allocData(*dataType, *xSize, *ySize);
+    ioStatsAlloc(function, (int64_t)dataTypeSize * (*xSize) * (*ySize));
+  }
   // Read Data
+  double t0 = ioStatsStart();
   status = GDALRasterIO(hBand, GF_Read, 0, 0, *xSize, *ySize, data, *xSize, *ySize, *dataType, 0, 0);
+  ioStatsStop(function, IOSTAT_READ, t0, (int64_t)(*xSize) * (*ySize) * dataTypeSize);
   readDataSetMetaData(hDS, metaDictionary);
   // fprintf(stderr, "read  %10.f %10.f \n", x[5], x[(300 * (*xSize) + 200)]);
   ifNEReturnCode(status,  CE_None, "readRasterVRT: Could not read band data\n");
+  releaseDataSet(hDS);
+  return data;
+}
+
+// Read band of fileName into a new buffer. Free it with CPLFree (or releaseData).
+void **readRasterVRT(char *fileName, int band, int *xSize, int *ySize, int *dataType, dictNode **metaDictionary)
+{
+  return readRasterBand(fileName, band, xSize, ySize, dataType, metaDictionary, FALSE);
+}
+
+/*
+As readRasterVRT, but into a buffer from the pool, so repeated reads of same-sized products reuse memory
+that is already paged in. Return it with releaseData, never CPLFree/free.
+*/
+void *readRasterVRTPooled(char *fileName, int band, int *xSize, int *ySize, int *dataType, dictNode **metaDictionary)
+{
+  return readRasterBand(fileName, band, xSize, ySize, dataType, metaDictionary, TRUE);
+}
+
+/*
+Read several bands (bands[0..nBands-1], 1-based) with a single open and one GDALDatasetRasterIO call.
+If bands is NULL or *nBands < 1, all bands are read and *nBands is set to the band count.
+The result is in the type of the first band read, either band sequential (INTERLEAVE_BAND) or
+pixel interleaved (INTERLEAVE_PIXEL). Return the result with releaseData.
+*/
+void *readRasterBandsVRT(char *fileName, int *bands, int *nBands, int interleave, int *xSize, int *ySize,
+                         int *dataType, dictNode **metaDictionary)
+{
+  int nDSBands, i, useAll, *bandList;
+  size_t dataTypeSize;
+  GSpacing pixelSpace, lineSpace, bandSpace;
+  CPLErr status;
+  void *data;
+  // Open data set and check valid bands requested
+  GDALDatasetH hDS = acquireDataSet(fileName);
+  ifNullError(hDS, "readRasterBandsVRT: Could not open %s\n", fileName);
+  nDSBands = GDALGetRasterCount(hDS);
+  useAll = (bands == NULL || *nBands < 1);
+  if (useAll)
+    *nBands = nDSBands;
+  bandList = (int *)CPLMalloc(sizeof(int) * (*nBands));
+  for (i = 0; i < *nBands; i++)
+  {
+    bandList[i] = useAll ? i + 1 : bands[i];
+    if (bandList[i] < 1 || bandList[i] > nDSBands)
+      error("readRasterBandsVRT: Invalid band %i", bandList[i]);
+  }
+  // Type and size from the first band requested
+  GDALRasterBandH hBand = GDALGetRasterBand(hDS, bandList[0]);
+  *dataType = GDALGetRasterDataType(hBand);
+  dataTypeSize = GDALGetDataTypeSizeBytes(*dataType);
+  *xSize = GDALGetRasterXSize(hDS);
+  *ySize = GDALGetRasterYSize(hDS);
+  // Buffer layout
+  if (interleave == INTERLEAVE_PIXEL)
+  {
+    pixelSpace = dataTypeSize * (*nBands);
+    lineSpace = pixelSpace * (*xSize);
+    bandSpace = dataTypeSize;
+  }
+  else
+  {
+    pixelSpace = dataTypeSize;
+    lineSpace = pixelSpace * (*xSize);
+    bandSpace = lineSpace * (*ySize);
+  }
+  data = allocBuffer(dataTypeSize * (size_t)(*xSize) * (size_t)(*ySize) * (size_t)(*nBands), "readRasterBandsVRT");
+  // Read all bands at once so GDAL can coalesce the I/O
+  double t0 = ioStatsStart();
+  status = GDALDatasetRasterIOEx(hDS, GF_Read, 0, 0, *xSize, *ySize, data, *xSize, *ySize, *dataType,
+                                 *nBands, bandList, pixelSpace, lineSpace, bandSpace, NULL);
+  ifNEReturnCode(status, CE_None, "readRasterBandsVRT: Could not read band data\n");
+  ioStatsStop("readRasterBandsVRT", IOSTAT_READ, t0, (int64_t)dataTypeSize * (*xSize) * (*ySize) * (*nBands));
+  readDataSetMetaData(hDS, metaDictionary);
+  CPLFree(bandList);
+  releaseDataSet(hDS);
   return data;
 }
 
@@ -4,25 +4,163 @@
 #include <gdal_utils.h>
 #include <gdal_vrt.h>
 #include <cpl_conv.h>
+#include <cpl_string.h>
 #include <stdarg.h>
+#include <stdio.h>
 #include <stdint.h>
 #include <string.h>
 // header contents
 #define DONOTINCLUDENODATA 1e30
+// Buffer layouts for multi-band reads and tiff output
+#define INTERLEAVE_BAND 0
+#define INTERLEAVE_PIXEL 1
+// Size of staging buffer used to byte swap output on the fly
+#define SWAPSTAGINGBYTES (256 * 1024)
+// Timers for I/O instrumentation
+#define IOSTAT_OPEN 0
+#define IOSTAT_READ 1
+#define IOSTAT_WRITE 2
+#define IOSTAT_CLOSE 3
+#define IOSTAT_COMPRESS 4
+#define IOSTAT_NTIMERS 5
+// Nodata handling for readRasterVRTAs
+#define NODATA_KEEP 0
+#define NODATA_TONAN 1
+// Quantization of float32 tiff output
+#define QUANTIZE_NONE 0
+#define QUANTIZE_FLOAT16 1
+#define QUANTIZE_INT16 2
+#define QUANTIZENODATA -32768
+#define FLOAT16MAX 65504.f
+// Maximum number of overview levels for COG output
+#define MAXOVERVIEWS 16
+// madvise hints for mapRasterVRT
+#define MAPADVICE_NORMAL 0
+#define MAPADVICE_SEQUENTIAL 1
+#define MAPADVICE_RANDOM 2
+#define MAPADVICE_WILLNEED 3
 typedef struct dictNode {
     char *key;
     char *value;
     struct dictNode *next;
 } dictNode;
+typedef struct dictIndex dictIndex;
 
 dictNode* create_node(char *key, char *value);
 void insert_node(dictNode **head, char *key, char *value);
 void free_dictionary(dictNode *head);
 char* get_value(dictNode *head, char *key);
 void printDictionary(dictNode *head);
+dictIndex *create_dict_index(dictNode **head);
+void dict_index_insert(dictIndex *index, char *key, char *value);
+char *dict_index_get_value(dictIndex *index, char *key);
+void free_dict_index(dictIndex *index);
 
+// Streaming (windowed/block) access to a single band
+typedef struct rasterStream {
+    GDALDatasetH dataSet;
+    GDALRasterBandH hBand;
+    int band;
+    int xSize, ySize;
+    int dataType, dataTypeSize;
+    int blockXSize, blockYSize; // Grid walked by nextRasterBlock
+    int nBlocksX, nBlocksY;
+    int64_t nextBlock;
+    void *buffer; // Reusable window buffer
+    size_t bufferSize;
+} rasterStream;
+
+// Band data returned by mapRasterVRT, either mapped from the raw file or allocated
+typedef struct rasterView {
+    void *data;
+    void *mapBase; // Start of mapping (NULL if data was allocated)
+    size_t mapLength;
+} rasterView;
+
+// Settings for writeRasterAsVRTDirect
+typedef struct rawWriteOptions {
+    int numThreads;    // pwrite threads (< 1 for all cores)
+    size_t chunkBytes; // Bytes per write (rounded to a multiple of 4096)
+    int directIO;      // Use O_DIRECT where supported
+} rawWriteOptions;
+
+// One VRT stack for makeTiffVRTBatch (arguments as for makeTiffVRT)
+typedef struct tiffVRTJob {
+    char *vrtFile;
+    const char **bands;
+    int nBands;
+    float *noDataValues;
+    dictNode *metaData;
+} tiffVRTJob;
+
+// Compression settings for GTiff/COG output
+typedef struct tiffWriteOptions {
+    char codec[16];  // DEFLATE, ZSTD, LZW, LERC, LERC_DEFLATE, LERC_ZSTD, or NONE
+    int level;       // Codec level (< 0 for driver default)
+    int predictor;   // 1 none, 2 horizontal, 3 floating point (< 1 for driver default)
+    int numThreads;  // Compression threads (< 1 for all cores)
+    int blockSize;   // Tile size for COG, or for GTiff if tiled
+    int tiled;       // Tile (TRUE) or strip (FALSE) GTiff output
+    // COG overviews
+    int overviews;                    // Build overviews (TRUE) or not (FALSE)
+    char overviewResampling[16];      // AVERAGE, NEAREST, MODE, or RMS (nodata is excluded)
+    int overviewLevels[MAXOVERVIEWS]; // Decimation factors, or automatic if nOverviewLevels is 0
+    int nOverviewLevels;
+    int interleave;                   // INTERLEAVE_BAND or INTERLEAVE_PIXEL for multi-band output
+    int sparse;                       // Omit all nodata tiles (SPARSE_OK); GTiff output is then tiled
+    // Lossy output
+    double maxZError;                 // Maximum error for LERC codecs and int16 quantization (<= 0 for none)
+    const double *bandMaxZError;      // Per band maxZError for multi-band output (NULL to use maxZError)
+    int quantize;                     // QUANTIZE_NONE, QUANTIZE_FLOAT16, or QUANTIZE_INT16 (float32 data only)
+    // Statistics stored with the data
+    int statistics;                   // Compute and store STATISTICS_* metadata (TRUE/FALSE)
+    int histogramBuckets;             // Also store a histogram with this many buckets (0 for none)
+    double histogramMin, histogramMax; // Histogram range, or the data range if min >= max
+} tiffWriteOptions;
+
+// One tile for saveAsGeotiffBatch (arguments as for saveAsGeotiffMultiBand)
+typedef struct tiffTileJob {
+    const char *filename;
+    const void **bands;
+    const char **bandDescriptions;
+    float *noDataValues;
+    int nBands;
+    int32_t width, height;
+    double geoTransform[6];
+    const char *epsg;
+    dictNode *metaData;
+    char *driverType;
+    int32_t dataType;
+    tiffWriteOptions *options; // NULL for defaults
+} tiffTileJob;
+
+// Band statistics from computeBandStatistics
+typedef struct bandStatistics {
+    double min, max, mean, stdDev;
+    int64_t nValid, nPixels;
+    int nBuckets;
+    double histMin, histMax;
+    GUIntBig *histogram; // nBuckets counts, or NULL
+} bandStatistics;
+
+// Background writer (asyncWriter.c) and its per-write handles
+typedef struct asyncWriter asyncWriter;
+typedef struct asyncWrite asyncWrite;
 
 void *allocData(int data_type, int width, int height);
+void *allocBuffer(size_t nBytes, const char *function);
+void releaseData(void *data);
+void setBufferPoolSize(int64_t maxBytes);
+GDALDatasetH acquireDataSet(const char *fileName);
+void releaseDataSet(GDALDatasetH hDS);
+void invalidateDataSet(const char *fileName);
+void setDataSetCacheSize(int size);
+int ioStatsEnabled();
+double ioStatsStart();
+void ioStatsStop(const char *function, int timer, double start, int64_t bytes);
+void ioStatsAlloc(const char *function, int64_t bytes);
+void ioStatsLog(const char *fmt, ...);
+void ioStatsDump(FILE *fp, int json);
 
 char *parseNameValue(char *metaBuf, char **value);
 void ifNEReturnCode(CPLErr returnCode, int code, char *msg, ...);
@@ -32,19 +170,87 @@ int readDataSetMetaData(GDALDatasetH dataSet, dictNode **metaDict);
 void writeSingleVRT(int32_t nR, int32_t nA, dictNode *metaData, char *vrtFile, char *bandFiles[], char *bandNames[],
                     GDALDataType dataTypes[], char *byteSwapOption, double noDataValue, int32_t nBands);
 int makeTiffVRT(char *vrtFile, const char **bands, int nBands, float *noDataValues, dictNode *metaData);
+int makeTiffVRTBatch(tiffVRTJob *jobs, int nJobs, int nThreads);
 int makeVRT(char *vrtFile, int xSize, int ySize, int dataType, char **bandNames, int nBands,
             double *geoTransform, int byteSwap, dictNode *metaData);
 char *checkForVrt(char *filename, char *vrtBuff);
 void *byteSwapData(void *buffer, int dataType, int64_t size);
+void *byteSwapCopy(const void *src, void *dst, int dataType, int64_t size);
+int byteSwapWordSize(int dataType);
 
 int writeRasterAsVRT(void *buffer, char *fileName, int xSize, int ySize, int dataType,
                      int band, double *geoTransform, int byteSwap, dictNode *metaData);
 
+void initRawWriteOptions(rawWriteOptions *options);
+int writeRasterAsVRTDirect(const void *buffer, char *fileName, int xSize, int ySize, int dataType,
+                           int band, double *geoTransform, int byteSwap, dictNode *metaData, rawWriteOptions *options);
 void **readRasterVRT(char *fileName, int band, int *xSize, int *ySize, int *dataType, dictNode **metaDictionary);
+void *readRasterVRTPooled(char *fileName, int band, int *xSize, int *ySize, int *dataType, dictNode **metaDictionary);
+void *readRasterBandsVRT(char *fileName, int *bands, int *nBands, int interleave, int *xSize, int *ySize,
+                         int *dataType, dictNode **metaDictionary);
+void *readRasterDecimated(char *fileName, int band, int decimation, int *outXSize, int *outYSize, int *xSize,
+                          int *ySize, int *dataType, dictNode **metaDictionary);
+int mapRasterVRT(char *fileName, int band, int *xSize, int *ySize, int *dataType, dictNode **metaDictionary,
+                 int advice, rasterView *view);
+void releaseRasterView(rasterView *view);
 char *appendSuff(char *file, char *suffix, char *buf);
-void saveAsGeotiff(const char *filename, void *data, int32_t width, int32_t height, double *geotransform,
+void saveAsGeotiff(const char *filename, const void *data, int32_t width, int32_t height, double *geotransform,
                    const char *epsg_code, dictNode *metaData, char *driverType, int32_t dataType, float noDataValue);
+void saveAsGeotiffWithOptions(const char *filename, const void *data, int32_t width, int32_t height, double *geotransform,
+                              const char *epsg_code, dictNode *metaData, char *driverType, int32_t dataType,
+                              float noDataValue, tiffWriteOptions *options);
+void saveAsGeotiffMultiBand(const char *filename, const void **bands, const char **bandDescriptions,
+                            float *noDataValues, int nBands, int32_t width, int32_t height, double *geotransform,
+                            const char *epsg_code, dictNode *metaData, char *driverType, int32_t dataType,
+                            tiffWriteOptions *options);
+void saveAsGeotiffBatch(tiffTileJob *jobs, int nJobs, int nThreads);
+void initTiffWriteOptions(tiffWriteOptions *options);
+char **tiffWriteOptionList(tiffWriteOptions *options, char *driverType, int dataType);
 char *timeStampMeta();                 
 void computeGeoTransform(double geoTransform[6], double x0, double y0, int32_t xSize, int32_t ySize, double deltaX, double deltaY);
 const char *getEPSGFromProjectionParams(double rot, double slat, int32_t hemisphere);
+const char *getProjectionCodeFromParams(double rot, double slat, int32_t hemisphere);
+const char *getProjectionWKT(const char *code);
+int isMemProduct(const char *fileName);
+char *memProductPath(const char *fileName, char *buf, size_t bufSize);
+void *takeMemProduct(const char *fileName, size_t *nBytes);
+int createMemProductFd(const char *fileName, size_t maxBytes);
+size_t finishMemProductFd(const char *fileName);
+char *openMemProduct(const char *fileName, void *data, size_t nBytes, int takeOwnership);
+char *openMemProductFd(const char *fileName, int fd);
+void releaseMemProduct(const char *fileName);
+rasterStream *openRasterStream(char *fileName, int band, dictNode **metaDictionary);
+void setRasterStreamBlockSize(rasterStream *stream, int blockXSize, int blockYSize);
+void resetRasterStream(rasterStream *stream);
+void *readRasterWindow(rasterStream *stream, int xOff, int yOff, int xWinSize, int yWinSize, void *buffer);
+void *readRasterWindowAs(rasterStream *stream, int xOff, int yOff, int xWinSize, int yWinSize, int bufferType,
+                         void *buffer);
+void *readRasterVRTAs(char *fileName, int band, int outType, int noDataPolicy, int *xSize, int *ySize,
+                      int *dataType, dictNode **metaDictionary);
+void *nextRasterBlock(rasterStream *stream, int *xOff, int *yOff, int *xWinSize, int *yWinSize);
+void closeRasterStream(rasterStream *stream);
+int windowIsNoData(const void *data, int64_t lineBytes, int nx, int ny, int dataType, double noData);
+void fillWithNoData(void *buffer, int dataType, int64_t nPixels, double noData);
+void computeBandStatistics(const void *data, int64_t n, int dataType, double noData, int hasNoData, int nBuckets,
+                           double histMin, double histMax, bandStatistics *stats);
+void setBandStatistics(GDALRasterBandH band, bandStatistics *stats);
+void setBandHistogram(GDALRasterBandH band, bandStatistics *stats);
+int16_t *quantizeToInt16(const float *src, int64_t n, double noData, int hasNoData, double maxZError,
+                         double *scale, double *offset);
+int64_t prepareFloat16(const float *src, int64_t n, float noData, int hasNoData, float **remapped);
+asyncWriter *createAsyncWriter(int nThreads, int maxQueued);
+asyncWrite *asyncSaveAsGeotiff(asyncWriter *writer, const char *filename, void *data, int ownsData, int32_t width,
+                               int32_t height, double *geotransform, const char *epsg_code, dictNode *metaData,
+                               char *driverType, int32_t dataType, float noDataValue, tiffWriteOptions *options,
+                               asyncWrite **after, int nAfter);
+asyncWrite *asyncWriteRasterAsVRT(asyncWriter *writer, void *buffer, int ownsData, char *fileName, int xSize,
+                                  int ySize, int dataType, int band, double *geoTransform, int byteSwap,
+                                  dictNode *metaData, asyncWrite **after, int nAfter);
+asyncWrite *asyncMakeTiffVRT(asyncWriter *writer, char *vrtFile, const char **bands, int nBands,
+                             float *noDataValues, dictNode *metaData, asyncWrite **after, int nAfter);
+int asyncWriteDone(asyncWrite *handle);
+void waitAsyncWrite(asyncWrite *handle);
+void releaseAsyncWrite(asyncWrite *handle);
+void flushAsyncWriter(asyncWriter *writer);
+void closeAsyncWriter(asyncWriter *writer);
 #endif
\ No newline at end of file
@@ -0,0 +1,179 @@
+#include <pthread.h>
+#include <sys/time.h>
+#include "gdalIO/gdalIO/grimpgdal.h"
+#include "mosaicSource/common/common.h"
+
+/*
+  I/O instrumentation. Set GRIMPIO_STATS=text or GRIMPIO_STATS=json to count opens, bytes read and
+  written, time in GDAL open/RasterIO/close/compression, and buffer allocations for each API function.
+  A summary is written at exit to stderr, or to GRIMPIO_STATS_FILE if set. GRIMPIO_VERBOSE=1 restores
+  the progress messages (ioStatsLog). When disabled, the hooks return after a single flag test.
+*/
+
+#define MAXSTATFUNCTIONS 64
+
+static const char *timerNames[IOSTAT_NTIMERS] = {"open", "read", "write", "close", "compress"};
+
+typedef struct ioFunctionStats {
+    const char *function;
+    int64_t count[IOSTAT_NTIMERS];
+    double seconds[IOSTAT_NTIMERS];
+    int64_t bytesRead, bytesWritten;
+    int64_t allocations, bytesAllocated, peakAllocation;
+} ioFunctionStats;
+
+static ioFunctionStats functionStats[MAXSTATFUNCTIONS];
+static int nFunctions = 0;
+static int statsMode = 0; // 0 off, 1 text, 2 json
+static int verbose = FALSE;
+static pthread_mutex_t statsMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t statsOnce = PTHREAD_ONCE_INIT;
+
+static void dumpAtExit()
+{
+    const char *file = getenv("GRIMPIO_STATS_FILE");
+    FILE *fp = (file != NULL) ? fopen(file, "w") : stderr;
+    if (fp == NULL)
+        fp = stderr;
+    ioStatsDump(fp, statsMode == 2);
+    if (fp != stderr)
+        fclose(fp);
+}
+
+static void initStats()
+{
+    const char *mode = getenv("GRIMPIO_STATS");
+    const char *verboseEnv = getenv("GRIMPIO_VERBOSE");
+    verbose = verboseEnv != NULL && atoi(verboseEnv) != 0;
+    // Only "text" and "json" turn stats on
+    if (mode == NULL)
+        return;
+    if (strcmp(mode, "text") == 0)
+        statsMode = 1;
+    else if (strcmp(mode, "json") == 0)
+        statsMode = 2;
+    else
+        return;
+    atexit(dumpAtExit);
+}
+
+int ioStatsEnabled()
+{
+    pthread_once(&statsOnce, initStats);
+    return statsMode != 0;
+}
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Entry for function, called with the mutex held. Function names are expected to be literals.
+static ioFunctionStats *getFunctionStats(const char *function)
+{
+    int i;
+    for (i = 0; i < nFunctions; i++)
+        if (functionStats[i].function == function || strcmp(functionStats[i].function, function) == 0)
+            return &functionStats[i];
+    if (nFunctions == MAXSTATFUNCTIONS)
+        return NULL;
+    memset(&functionStats[nFunctions], 0, sizeof(ioFunctionStats));
+    functionStats[nFunctions].function = function;
+    return &functionStats[nFunctions++];
+}
+
+// Start time for an operation (0 if disabled).
+double ioStatsStart()
+{
+    return ioStatsEnabled() ? now() : 0.;
+}
+
+// Record an operation of type timer started at start, which moved bytes (reads/writes).
+void ioStatsStop(const char *function, int timer, double start, int64_t bytes)
+{
+    ioFunctionStats *stats;
+    double elapsed;
+    if (ioStatsEnabled() == FALSE)
+        return;
+    elapsed = now() - start;
+    pthread_mutex_lock(&statsMutex);
+    if ((stats = getFunctionStats(function)) != NULL)
+    {
+        stats->count[timer]++;
+        stats->seconds[timer] += elapsed;
+        if (timer == IOSTAT_READ)
+            stats->bytesRead += bytes;
+        else if (timer == IOSTAT_WRITE || timer == IOSTAT_COMPRESS)
+            stats->bytesWritten += bytes;
+    }
+    pthread_mutex_unlock(&statsMutex);
+}
+
+// Record a buffer allocation of bytes by function.
+void ioStatsAlloc(const char *function, int64_t bytes)
+{
+    ioFunctionStats *stats;
+    if (ioStatsEnabled() == FALSE)
+        return;
+    pthread_mutex_lock(&statsMutex);
+    if ((stats = getFunctionStats(function)) != NULL)
+    {
+        stats->allocations++;
+        stats->bytesAllocated += bytes;
+        if (bytes > stats->peakAllocation)
+            stats->peakAllocation = bytes;
+    }
+    pthread_mutex_unlock(&statsMutex);
+}
+
+// Progress messages, printed only if GRIMPIO_VERBOSE is set.
+void ioStatsLog(const char *fmt, ...)
+{
+    va_list args;
+    pthread_once(&statsOnce, initStats);
+    if (verbose == FALSE)
+        return;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+void ioStatsDump(FILE *fp, int json)
+{
+    ioFunctionStats *stats;
+    int i, j;
+    pthread_mutex_lock(&statsMutex);
+    if (json == TRUE)
+        fprintf(fp, "{\n");
+    else
+        fprintf(fp, "%-28s %8s %10s %10s %10s %10s %10s %10s %10s %10s %10s\n", "gdalIO function", "opens",
+                "open(s)", "read(MB)", "read(s)", "write(MB)", "write(s)", "close(s)", "compr(s)", "allocs",
+                "peak(MB)");
+    for (i = 0; i < nFunctions; i++)
+    {
+        stats = &functionStats[i];
+        if (json == TRUE)
+        {
+            fprintf(fp, "  \"%s\": {\"bytesRead\": %lld, \"bytesWritten\": %lld, \"allocations\": %lld, "
+                        "\"bytesAllocated\": %lld, \"peakAllocation\": %lld",
+                    stats->function, (long long)stats->bytesRead, (long long)stats->bytesWritten,
+                    (long long)stats->allocations, (long long)stats->bytesAllocated,
+                    (long long)stats->peakAllocation);
+            for (j = 0; j < IOSTAT_NTIMERS; j++)
+                fprintf(fp, ", \"%sCount\": %lld, \"%sSeconds\": %.6f", timerNames[j], (long long)stats->count[j],
+                        timerNames[j], stats->seconds[j]);
+            fprintf(fp, "}%s\n", (i < nFunctions - 1) ? "," : "");
+        }
+        else
+            fprintf(fp, "%-28s %8lld %10.3f %10.1f %10.3f %10.1f %10.3f %10.3f %10.3f %10lld %10.1f\n",
+                    stats->function, (long long)stats->count[IOSTAT_OPEN], stats->seconds[IOSTAT_OPEN],
+                    stats->bytesRead / 1048576., stats->seconds[IOSTAT_READ], stats->bytesWritten / 1048576.,
+                    stats->seconds[IOSTAT_WRITE], stats->seconds[IOSTAT_CLOSE], stats->seconds[IOSTAT_COMPRESS],
+                    (long long)stats->allocations, stats->peakAllocation / 1048576.);
+    }
+    if (json == TRUE)
+        fprintf(fp, "}\n");
+    pthread_mutex_unlock(&statsMutex);
+}
@@ -0,0 +1,277 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cpl_vsi.h"
+#include "gdalIO/gdalIO/grimpgdal.h"
+#include "mosaicSource/common/common.h"
+
+/*
+  In-memory products for chaining processing stages without disk. Any writer (saveAsGeotiff,
+  writeRasterAsVRT, makeTiffVRT, ...) can write to a GDAL /vsimem/ path (see memProductPath), and any
+  reader can read one back. A finished product can be taken as a byte buffer (takeMemProduct) with no
+  copy, or written straight into an anonymous memory file (createMemProductFd/finishMemProductFd) whose
+  descriptor is handed to another process or stage. Buffers and descriptors from another stage are
+  opened for the readers with openMemProduct/openMemProductFd, again without copies.
+*/
+
+// /vsimem files whose memory GDAL does not own: mappings, to unmap when the product is finished or
+// released, and caller buffers (map NULL), which must never be taken
+typedef struct memProductMap {
+    char *fileName;
+    void *map;
+    size_t mapBytes;
+    int fd; // Descriptor being written (createMemProductFd), or -1 for read-back mappings
+} memProductMap;
+
+static memProductMap *maps = NULL;
+static int nMaps = 0, maxMaps = 0;
+static pthread_mutex_t mapMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void addMap(const char *fileName, void *map, size_t mapBytes, int fd)
+{
+    pthread_mutex_lock(&mapMutex);
+    if (nMaps == maxMaps)
+    {
+        maxMaps = (maxMaps == 0) ? 8 : 2 * maxMaps;
+        maps = (memProductMap *)CPLRealloc(maps, sizeof(memProductMap) * maxMaps);
+    }
+    maps[nMaps].fileName = CPLStrdup(fileName);
+    maps[nMaps].map = map;
+    maps[nMaps].mapBytes = mapBytes;
+    maps[nMaps].fd = fd;
+    nMaps++;
+    pthread_mutex_unlock(&mapMutex);
+}
+
+// Remove the mapping for fileName, returning FALSE if there is none.
+static int removeMap(const char *fileName, memProductMap *removed)
+{
+    int i, found = FALSE;
+    pthread_mutex_lock(&mapMutex);
+    for (i = 0; i < nMaps; i++)
+    {
+        if (strcmp(maps[i].fileName, fileName) == 0)
+        {
+            *removed = maps[i];
+            maps[i] = maps[--nMaps];
+            found = TRUE;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mapMutex);
+    return found;
+}
+
+// TRUE if fileName is backed by a mapping rather than memory GDAL owns.
+static int hasMap(const char *fileName)
+{
+    int i, found = FALSE;
+    pthread_mutex_lock(&mapMutex);
+    for (i = 0; i < nMaps && found == FALSE; i++)
+        found = strcmp(maps[i].fileName, fileName) == 0;
+    pthread_mutex_unlock(&mapMutex);
+    return found;
+}
+
+// Unmap any mapping for fileName (closing a descriptor still being written).
+static void dropMap(const char *fileName)
+{
+    memProductMap entry;
+    if (removeMap(fileName, &entry) == TRUE)
+    {
+        if (entry.map != NULL)
+            munmap(entry.map, entry.mapBytes);
+        if (entry.fd >= 0)
+            close(entry.fd);
+        CPLFree(entry.fileName);
+    }
+}
+
+static int memFd(const char *fileName)
+{
+#ifdef MFD_CLOEXEC
+    return memfd_create(CPLGetFilename(fileName), MFD_CLOEXEC);
+#else
+    error("memFd: Memory files are not supported on this system (%s)\n", fileName);
+    return -1;
+#endif
+}
+
+// TRUE if fileName is in GDAL's in-memory file system.
+int isMemProduct(const char *fileName)
+{
+    return fileName != NULL && strncmp(fileName, "/vsimem/", 8) == 0;
+}
+
+/*
+  In-memory path for fileName (e.g., "tile.tif" -> "/vsimem/tile.tif"), keeping any directories so
+  relative VRT sources still resolve. Paths already in memory are returned unchanged.
+*/
+char *memProductPath(const char *fileName, char *buf, size_t bufSize)
+{
+    if (isMemProduct(fileName))
+        snprintf(buf, bufSize, "%s", fileName);
+    else
+        snprintf(buf, bufSize, "/vsimem/%s", fileName + (fileName[0] == '/'));
+    return buf;
+}
+
+/*
+  Take the contents of the in-memory file fileName, which is removed. No copy is made. Returns NULL if
+  there is no such file, or if its memory is not GDAL's to give (from openMemProduct without ownership,
+  openMemProductFd, or createMemProductFd). Free the buffer with VSIFree.
+*/
+void *takeMemProduct(const char *fileName, size_t *nBytes)
+{
+    vsi_l_offset length = 0;
+    GByte *data;
+    //
+    if (hasMap(fileName))
+    {
+        ioStatsLog("takeMemProduct: %s is mapped, not owned by GDAL\n", fileName);
+        return NULL;
+    }
+    // Cached handles would still reference the buffer
+    invalidateDataSet(fileName);
+    data = VSIGetMemFileBuffer(fileName, &length, TRUE);
+    if (data == NULL)
+        return NULL;
+    VSIUnlink(fileName);
+    *nBytes = (size_t)length;
+    return data;
+}
+
+/*
+  Make the in-memory file fileName write straight into a new memory file descriptor, so a product
+  written to fileName can be handed off with finishMemProductFd without copies. maxBytes bounds the size
+  of the product (pages are only used as they are written, so the uncompressed size plus some slack for
+  headers is safe). Products written over several files (e.g., writeRasterAsVRT) need one per file.
+*/
+int createMemProductFd(const char *fileName, size_t maxBytes)
+{
+    VSILFILE *fp;
+    void *map;
+    int fd;
+    //
+    if (!isMemProduct(fileName))
+        error("createMemProductFd: %s is not a /vsimem/ path\n", fileName);
+    fd = memFd(fileName);
+    if (fd < 0 || ftruncate(fd, (off_t)maxBytes) != 0)
+        error("createMemProductFd: Could not make a %lld byte memory file for %s\n", (long long)maxBytes, fileName);
+    map = mmap(NULL, maxBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        error("createMemProductFd: Could not map memory file for %s\n", fileName);
+    // GDAL writes into the mapping, truncating and growing the file within maxBytes
+    invalidateDataSet(fileName);
+    VSIUnlink(fileName);
+    dropMap(fileName);
+    fp = VSIFileFromMemBuffer(fileName, (GByte *)map, maxBytes, FALSE);
+    ifNullError(fp, "createMemProductFd: Could not create %s\n", fileName);
+    VSIFCloseL(fp);
+    addMap(fileName, map, maxBytes, fd);
+    return fd;
+}
+
+/*
+  Finish a product written to fileName after createMemProductFd. fileName is removed, and the
+  descriptor, now sized to the product and positioned at its start, belongs to the caller. Returns the
+  product size.
+*/
+size_t finishMemProductFd(const char *fileName)
+{
+    memProductMap entry;
+    vsi_l_offset length = 0;
+    GByte *data;
+    //
+    if (removeMap(fileName, &entry) == FALSE || entry.fd < 0)
+        error("finishMemProductFd: %s was not made by createMemProductFd\n", fileName);
+    invalidateDataSet(fileName);
+    data = VSIGetMemFileBuffer(fileName, &length, FALSE);
+    ifNullError(data, "finishMemProductFd: %s was not written\n", fileName);
+    munmap(entry.map, entry.mapBytes);
+    if (data == (GByte *)entry.map)
+    {
+        if (ftruncate(entry.fd, (off_t)length) != 0)
+            error("finishMemProductFd: Could not size memory file for %s\n", fileName);
+    }
+    else
+    {
+        // The driver replaced the file rather than truncating it, so copy its contents
+        ioStatsLog("finishMemProductFd: Copying %lld bytes for %s\n", (long long)length, fileName);
+        if (ftruncate(entry.fd, 0) != 0 || pwrite(entry.fd, data, length, 0) != (ssize_t)length)
+            error("finishMemProductFd: Could not write memory file for %s\n", fileName);
+    }
+    VSIUnlink(fileName);
+    lseek(entry.fd, 0, SEEK_SET);
+    CPLFree(entry.fileName);
+    return (size_t)length;
+}
+
+// Make data the contents of the in-memory file fileName, replacing (and unmapping) any earlier product.
+static void memFileFromBuffer(const char *fileName, void *data, size_t nBytes, int takeOwnership)
+{
+    VSILFILE *fp;
+    if (!isMemProduct(fileName))
+        error("openMemProduct: %s is not a /vsimem/ path\n", fileName);
+    invalidateDataSet(fileName);
+    VSIUnlink(fileName);
+    dropMap(fileName);
+    fp = VSIFileFromMemBuffer(fileName, (GByte *)data, nBytes, takeOwnership);
+    ifNullError(fp, "openMemProduct: Could not create %s\n", fileName);
+    VSIFCloseL(fp);
+}
+
+/*
+  Make nBytes of data (e.g., from takeMemProduct) readable as the in-memory file fileName, which is
+  returned for the readers. With takeOwnership TRUE the buffer (VSIMalloc'ed) is freed with the file,
+  otherwise it must outlive it. Remove the file with releaseMemProduct.
+*/
+char *openMemProduct(const char *fileName, void *data, size_t nBytes, int takeOwnership)
+{
+    memFileFromBuffer(fileName, data, nBytes, takeOwnership);
+    if (takeOwnership == FALSE)
+        addMap(fileName, NULL, 0, -1);
+    return (char *)fileName;
+}
+
+/*
+  Make the product in fd (e.g., from finishMemProductFd) readable as the in-memory file fileName by
+  mapping it (copy on write, so the descriptor is never modified). The caller keeps fd. Remove the file
+  with releaseMemProduct.
+*/
+char *openMemProductFd(const char *fileName, int fd)
+{
+    struct stat fileStat;
+    void *map;
+    //
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size <= 0)
+        error("openMemProductFd: Invalid descriptor %i for %s\n", fd, fileName);
+    map = mmap(NULL, fileStat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        error("openMemProductFd: Could not map descriptor %i for %s\n", fd, fileName);
+    memFileFromBuffer(fileName, map, fileStat.st_size, FALSE);
+    addMap(fileName, map, fileStat.st_size, -1);
+    return (char *)fileName;
+}
+
+// Remove the in-memory product fileName and its sidecars (.vrt, .hdr, .aux.xml).
+void releaseMemProduct(const char *fileName)
+{
+    const char *suffixes[] = {".vrt", ".aux.xml", ".vrt.aux.xml"};
+    char buf[2048];
+    int i;
+    //
+    invalidateDataSet(fileName);
+    VSIUnlink(fileName);
+    for (i = 0; i < (int)(sizeof(suffixes) / sizeof(suffixes[0])); i++)
+    {
+        snprintf(buf, sizeof(buf), "%s%s", fileName, suffixes[i]);
+        invalidateDataSet(buf);
+        VSIUnlink(buf);
+    }
+    VSIUnlink(CPLResetExtension(fileName, "hdr"));
+    dropMap(fileName);
+}
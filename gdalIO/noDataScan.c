@@ -0,0 +1,118 @@
+#include <math.h>
+#include "gdalIO/gdalIO/grimpgdal.h"
+#include "mosaicSource/common/common.h"
+
+/*
+  Nodata helpers for sparse output and reads. windowIsNoData tests whether a window of a buffer is all
+  nodata. The inner loops have no early exit, so the compiler vectorizes the compares, and each row is
+  tested once it is scanned. fillWithNoData fills a buffer with a nodata value without any I/O.
+*/
+
+// Integer types. A nodata value the type cannot represent matches no pixels.
+#define NODATASCANINT(NAME, TYPE)                                                              \
+    static int NAME(const unsigned char *data, int64_t lineBytes, int nx, int ny, double noData) \
+    {                                                                                          \
+        TYPE value = (TYPE)noData;                                                             \
+        int i, j, differ;                                                                      \
+        if (isnan(noData) || (double)value != noData)                                          \
+            return FALSE;                                                                      \
+        for (j = 0; j < ny; j++)                                                               \
+        {                                                                                      \
+            const TYPE *row = (const TYPE *)(data + j * lineBytes);                            \
+            differ = 0;                                                                        \
+            for (i = 0; i < nx; i++)                                                           \
+                differ |= row[i] != value;                                                     \
+            if (differ)                                                                        \
+                return FALSE;                                                                  \
+        }                                                                                      \
+        return TRUE;                                                                           \
+    }
+
+// Floating point types, where nodata may be NaN.
+#define NODATASCANFLOAT(NAME, TYPE)                                                            \
+    static int NAME(const unsigned char *data, int64_t lineBytes, int nx, int ny, double noData) \
+    {                                                                                          \
+        TYPE value = (TYPE)noData;                                                             \
+        int i, j, differ;                                                                      \
+        for (j = 0; j < ny; j++)                                                               \
+        {                                                                                      \
+            const TYPE *row = (const TYPE *)(data + j * lineBytes);                            \
+            differ = 0;                                                                        \
+            if (isnan(noData))                                                                 \
+                for (i = 0; i < nx; i++)                                                       \
+                    differ |= row[i] == row[i];                                                \
+            else                                                                               \
+                for (i = 0; i < nx; i++)                                                       \
+                    differ |= row[i] != value;                                                 \
+            if (differ)                                                                        \
+                return FALSE;                                                                  \
+        }                                                                                      \
+        return TRUE;                                                                           \
+    }
+
+NODATASCANINT(scanUInt8, uint8_t)
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3, 7, 0)
+NODATASCANINT(scanInt8, int8_t)
+#endif
+NODATASCANINT(scanUInt16, uint16_t)
+NODATASCANINT(scanInt16, int16_t)
+NODATASCANINT(scanUInt32, uint32_t)
+NODATASCANINT(scanInt32, int32_t)
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3, 5, 0)
+NODATASCANINT(scanUInt64, uint64_t)
+NODATASCANINT(scanInt64, int64_t)
+#endif
+NODATASCANFLOAT(scanFloat32, float)
+NODATASCANFLOAT(scanFloat64, double)
+
+/*
+  Return TRUE if the nx x ny window starting at data, with rows lineBytes apart (negative for bottom-up
+  buffers), is all noData. Complex types are never reported as empty.
+*/
+int windowIsNoData(const void *data, int64_t lineBytes, int nx, int ny, int dataType, double noData)
+{
+    const unsigned char *window = (const unsigned char *)data;
+    switch (dataType)
+    {
+    case GDT_Byte:
+        return scanUInt8(window, lineBytes, nx, ny, noData);
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3, 7, 0)
+    case GDT_Int8:
+        return scanInt8(window, lineBytes, nx, ny, noData);
+#endif
+    case GDT_UInt16:
+        return scanUInt16(window, lineBytes, nx, ny, noData);
+    case GDT_Int16:
+        return scanInt16(window, lineBytes, nx, ny, noData);
+    case GDT_UInt32:
+        return scanUInt32(window, lineBytes, nx, ny, noData);
+    case GDT_Int32:
+        return scanInt32(window, lineBytes, nx, ny, noData);
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3, 5, 0)
+    case GDT_UInt64:
+        return scanUInt64(window, lineBytes, nx, ny, noData);
+    case GDT_Int64:
+        return scanInt64(window, lineBytes, nx, ny, noData);
+#endif
+    case GDT_Float32:
+        return scanFloat32(window, lineBytes, nx, ny, noData);
+    case GDT_Float64:
+        return scanFloat64(window, lineBytes, nx, ny, noData);
+    default:
+        return FALSE;
+    }
+}
+
+// Fill nPixels of buffer (dataType) with noData.
+void fillWithNoData(void *buffer, int dataType, int64_t nPixels, double noData)
+{
+    int64_t offset, n;
+    int dataTypeSize = GDALGetDataTypeSizeBytes(dataType);
+    // GDALCopyWords counts are int, so go in pieces
+    for (offset = 0; offset < nPixels; offset += n)
+    {
+        n = (nPixels - offset > INT32_MAX) ? INT32_MAX : nPixels - offset;
+        GDALCopyWords(&noData, GDT_Float64, 0, (unsigned char *)buffer + offset * dataTypeSize, dataType,
+                      dataTypeSize, (int)n);
+    }
+}
@@ -0,0 +1,164 @@
+#include <math.h>
+#include <pthread.h>
+#include "ogr_srs_api.h"
+#include "gdalIO/gdalIO/grimpgdal.h"
+#include "mosaicSource/common/common.h"
+
+/*
+  Thread-safe registry of projections used by the writers. Each projection is resolved once (an EPSG
+  import hits the PROJ database) and its WKT is cached for the life of the process, so writers only
+  look up a string. Projections are identified by code: an EPSG code (e.g., "3413"), or for GrIMP
+  polar stereographic parameters with no EPSG equivalent, a "PS:slat:rot:N|S" code made by
+  getProjectionCodeFromParams. Returned strings are owned by the registry and never freed.
+*/
+
+typedef struct projectionEntry {
+    char *code;
+    char *wkt; // NULL if the code could not be resolved
+} projectionEntry;
+
+static projectionEntry **entries = NULL;
+static int nEntries = 0, maxEntries = 0;
+static pthread_mutex_t registryMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// GrIMP parameters with standard EPSG codes
+static const struct {
+    double rot, slat;
+    int32_t hemisphere;
+    const char *epsg;
+} knownProjections[] = {{45., 70., NORTH, "3413"}, {0., 71., SOUTH, "3031"}};
+
+// Called with the mutex held.
+static projectionEntry *findEntry(const char *code)
+{
+    int i;
+    for (i = 0; i < nEntries; i++)
+        if (strcmp(entries[i]->code, code) == 0)
+            return entries[i];
+    return NULL;
+}
+
+// Add an entry, or return the existing one if another thread got there first.
+static projectionEntry *addEntry(const char *code, char *wkt)
+{
+    projectionEntry *entry;
+    pthread_mutex_lock(&registryMutex);
+    if ((entry = findEntry(code)) != NULL)
+    {
+        pthread_mutex_unlock(&registryMutex);
+        CPLFree(wkt);
+        return entry;
+    }
+    if (nEntries == maxEntries)
+    {
+        maxEntries = (maxEntries == 0) ? 8 : 2 * maxEntries;
+        entries = (projectionEntry **)CPLRealloc(entries, sizeof(projectionEntry *) * maxEntries);
+    }
+    entry = (projectionEntry *)CPLMalloc(sizeof(projectionEntry));
+    entry->code = CPLStrdup(code);
+    entry->wkt = wkt;
+    entries[nEntries++] = entry;
+    pthread_mutex_unlock(&registryMutex);
+    return entry;
+}
+
+// WKT for srs (CPLFree), or NULL.
+static char *exportWKT(OGRSpatialReferenceH srs)
+{
+    char *wkt = NULL;
+    if (OSRExportToWkt(srs, &wkt) != OGRERR_NONE)
+    {
+        CPLFree(wkt);
+        return NULL;
+    }
+    return wkt;
+}
+
+/*
+  WKT for an EPSG code or a code from getProjectionCodeFromParams, resolved on first use.
+  Returns NULL if the code is unknown.
+*/
+const char *getProjectionWKT(const char *code)
+{
+    projectionEntry *entry;
+    OGRSpatialReferenceH srs;
+    char *wkt = NULL;
+    //
+    if (code == NULL)
+        return NULL;
+    pthread_mutex_lock(&registryMutex);
+    entry = findEntry(code);
+    pthread_mutex_unlock(&registryMutex);
+    if (entry != NULL)
+        return entry->wkt;
+    // Resolve outside the lock; PS codes are registered when they are made
+    if (strncmp(code, "PS:", 3) == 0)
+        return NULL;
+    srs = OSRNewSpatialReference(NULL);
+    if (OSRImportFromEPSG(srs, atoi(code)) == OGRERR_NONE)
+        wkt = exportWKT(srs);
+    else
+        CPLErrorReset(); // Unknown codes are reported by returning NULL, not as a write failure
+    OSRDestroySpatialReference(srs);
+    return addEntry(code, wkt)->wkt;
+}
+
+// Index in knownProjections of GrIMP parameters (rot, standard latitude slat, hemisphere), or -1.
+static int knownProjection(double rot, double slat, int32_t hemisphere)
+{
+    int i;
+    for (i = 0; i < (int)(sizeof(knownProjections) / sizeof(knownProjections[0])); i++)
+        if (fabs(rot - knownProjections[i].rot) < 1e-9 && fabs(slat - knownProjections[i].slat) < 1e-9 &&
+            hemisphere == knownProjections[i].hemisphere)
+            return i;
+    return -1;
+}
+
+// EPSG code for GrIMP polar stereographic parameters. Parameters with no EPSG code are an error.
+const char *getEPSGFromProjectionParams(double rot, double slat, int32_t hemisphere)
+{
+    int i = knownProjection(rot, slat, hemisphere);
+    if (i < 0)
+        error("getEPSGFromProjectionParams: Could not determine EPSG code from rot=%lf slat=%lf hemisphere=%i\n", rot,
+              slat, hemisphere);
+    return knownProjections[i].epsg;
+}
+
+/*
+  Projection code for GrIMP polar stereographic parameters for saveAsGeotiffMultiBand. Known
+  projections return their EPSG code. Others get a WGS84 polar stereographic with standard parallel
+  slat and central meridian -rot, registered under a "PS:" code for getProjectionWKT.
+*/
+const char *getProjectionCodeFromParams(double rot, double slat, int32_t hemisphere)
+{
+    projectionEntry *entry;
+    OGRSpatialReferenceH srs;
+    char code[128], *wkt;
+    int i;
+    //
+    if (hemisphere != NORTH && hemisphere != SOUTH)
+        error("getProjectionCodeFromParams: Invalid hemisphere %i for rot=%lf slat=%lf\n", hemisphere, rot, slat);
+    if ((i = knownProjection(rot, slat, hemisphere)) >= 0)
+        return knownProjections[i].epsg;
+    // Custom projection
+    snprintf(code, sizeof(code), "PS:%.9g:%.9g:%c", slat, rot, hemisphere == NORTH ? 'N' : 'S');
+    pthread_mutex_lock(&registryMutex);
+    entry = findEntry(code);
+    pthread_mutex_unlock(&registryMutex);
+    if (entry != NULL)
+        return entry->code;
+    srs = OSRNewSpatialReference(NULL);
+    if (OSRSetWellKnownGeogCS(srs, "WGS84") != OGRERR_NONE ||
+        OSRSetPS(srs, hemisphere == NORTH ? fabs(slat) : -fabs(slat), -rot, 1., 0., 0.) != OGRERR_NONE)
+        error("getProjectionCodeFromParams: Could not determine projection for rot=%lf slat=%lf hemisphere=%i\n",
+              rot, slat, hemisphere);
+    OSRSetLinearUnits(srs, SRS_UL_METER, 1.);
+    wkt = exportWKT(srs);
+    OSRDestroySpatialReference(srs);
+    if (wkt == NULL)
+        error("getProjectionCodeFromParams: Could not make WKT for rot=%lf slat=%lf hemisphere=%i\n", rot, slat,
+              hemisphere);
+    ioStatsLog("getProjectionCodeFromParams: No EPSG code for rot=%lf slat=%lf hemisphere=%i, using %s\n", rot, slat,
+               hemisphere, code);
+    return addEntry(code, wkt)->code;
+}
@@ -0,0 +1,175 @@
+#include <float.h>
+#include <math.h>
+#include "gdalIO/gdalIO/grimpgdal.h"
+#include "mosaicSource/common/common.h"
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define QUANTIZESIMD 1
+#endif
+
+/*
+  Scaled int16 quantization of float32 bands for lossy tiff output. Values are stored as
+  round((value - offset) / scale), clamped to +/-32767, with QUANTIZENODATA for nodata and NaN, so
+  the error is at most scale / 2. On x86_64 an AVX2 kernel is selected at run time, with a scalar
+  fallback that rounds identically. Float16 output (NBITS=16) is checked against its range with
+  prepareFloat16.
+*/
+
+// Range of valid (not nodata or NaN) values.
+static int64_t validRange(const float *src, int64_t n, float noData, int hasNoData, float *minValue, float *maxValue)
+{
+    int64_t i, nValid = 0;
+    float value;
+    *minValue = INFINITY;
+    *maxValue = -INFINITY;
+    for (i = 0; i < n; i++)
+    {
+        value = src[i];
+        if (isnan(value) || (hasNoData && value == noData))
+            continue;
+        *minValue = (value < *minValue) ? value : *minValue;
+        *maxValue = (value > *maxValue) ? value : *maxValue;
+        nValid++;
+    }
+    return nValid;
+}
+
+static void quantizeInt16Scalar(const float *src, int16_t *dst, int64_t n, float noData, int hasNoData,
+                                float offset, float invScale)
+{
+    int64_t i;
+    float value;
+    for (i = 0; i < n; i++)
+    {
+        value = src[i];
+        if (isnan(value) || (hasNoData && value == noData))
+        {
+            dst[i] = QUANTIZENODATA;
+            continue;
+        }
+        value = (value - offset) * invScale;
+        value = (value < -32767.f) ? -32767.f : ((value > 32767.f) ? 32767.f : value);
+        dst[i] = (int16_t)lrintf(value);
+    }
+}
+
+#ifdef QUANTIZESIMD
+// 16 values per iteration, returning the number done.
+__attribute__((target("avx2"))) static int64_t quantizeInt16AVX2(const float *src, int16_t *dst, int64_t n,
+                                                                   float noData, int hasNoData, float offset,
+                                                                   float invScale)
+{
+    int64_t i;
+    __m256 vOffset = _mm256_set1_ps(offset), vInvScale = _mm256_set1_ps(invScale);
+    __m256 vMin = _mm256_set1_ps(-32767.f), vMax = _mm256_set1_ps(32767.f), vNoData = _mm256_set1_ps(noData);
+    __m256i noDataWords = _mm256_set1_epi16(QUANTIZENODATA);
+    for (i = 0; i + 16 <= n; i += 16)
+    {
+        __m256 a = _mm256_loadu_ps(src + i), b = _mm256_loadu_ps(src + i + 8);
+        // Nodata lanes
+        __m256 maskA = _mm256_cmp_ps(a, a, _CMP_UNORD_Q), maskB = _mm256_cmp_ps(b, b, _CMP_UNORD_Q);
+        if (hasNoData)
+        {
+            maskA = _mm256_or_ps(maskA, _mm256_cmp_ps(a, vNoData, _CMP_EQ_OQ));
+            maskB = _mm256_or_ps(maskB, _mm256_cmp_ps(b, vNoData, _CMP_EQ_OQ));
+        }
+        // Scale, clamp, and round to nearest (even) as lrintf
+        a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(a, vOffset), vInvScale), vMin), vMax);
+        b = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(b, vOffset), vInvScale), vMin), vMax);
+        // packs works per 128 bit lane, so restore the order with a 64 bit permute
+        __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b)),
+                                                 0xD8);
+        __m256i mask = _mm256_permute4x64_epi64(
+            _mm256_packs_epi32(_mm256_castps_si256(maskA), _mm256_castps_si256(maskB)), 0xD8);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_blendv_epi8(words, noDataWords, mask));
+    }
+    return i;
+}
+
+static int quantizeHasAVX2()
+{
+    static int hasAVX2 = -1;
+    if (hasAVX2 < 0)
+    {
+        __builtin_cpu_init();
+        hasAVX2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return hasAVX2;
+}
+#endif
+
+/*
+  Quantize n float32 values to a new int16 buffer (return with releaseData), returning the scale and offset
+  (value = scale * stored + offset). If maxZError > 0, scale is just under 2 * maxZError unless the range needs a
+  coarser scale, which is warned about with CPLError; the bound applied is always scale / 2. Otherwise the range
+  of valid values is spread over the full int16 range.
+*/
+int16_t *quantizeToInt16(const float *src, int64_t n, double noData, int hasNoData, double maxZError,
+                         double *scale, double *offset)
+{
+    int16_t *dst;
+    float minValue, maxValue;
+    int64_t done = 0;
+    double rangeScale;
+    //
+    if (validRange(src, n, (float)noData, hasNoData, &minValue, &maxValue) == 0)
+        minValue = maxValue = 0.f;
+    // 65534 steps between -32767 and 32767
+    rangeScale = ((double)maxValue - (double)minValue) / 65534.;
+    *offset = 0.5 * ((double)minValue + (double)maxValue);
+    if (maxZError > 0.)
+    {
+        // Allow for float rounding in the kernels
+        *scale = 2. * (maxZError - 4. * FLT_EPSILON * fmax(fabs(minValue), fabs(maxValue)));
+        *scale = (*scale > 0.) ? *scale : 2. * maxZError;
+        if (rangeScale > *scale)
+        {
+            CPLError(CE_Warning, CPLE_AppDefined,
+                     "quantizeToInt16: Range [%g, %g] needs scale %g, so the error bound is %g, not %g", minValue,
+                     maxValue, rangeScale, 0.5 * rangeScale, maxZError);
+            *scale = rangeScale;
+        }
+    }
+    else
+        *scale = (rangeScale > 0.) ? rangeScale : 1.;
+    dst = (int16_t *)allocBuffer(sizeof(int16_t) * n, "quantizeToInt16");
+#ifdef QUANTIZESIMD
+    if (quantizeHasAVX2())
+        done = quantizeInt16AVX2(src, dst, n, (float)noData, hasNoData, (float)*offset, (float)(1. / *scale));
+#endif
+    quantizeInt16Scalar(src + done, dst + done, n - done, (float)noData, hasNoData, (float)*offset,
+                        (float)(1. / *scale));
+    return dst;
+}
+
+/*
+  Check n float32 values for Float16 (NBITS=16) output, which holds at most FLOAT16MAX in magnitude.
+  Returns the number of valid values beyond that (infinities excepted), which cannot be stored. Nodata
+  beyond it (e.g., DONOTINCLUDENODATA) cannot be stored either, so is replaced by NaN in a copy returned in
+  *remapped (return with releaseData); otherwise *remapped is NULL.
+*/
+int64_t prepareFloat16(const float *src, int64_t n, float noData, int hasNoData, float **remapped)
+{
+    int64_t i, nOver = 0;
+    float value, *dst = NULL;
+    //
+    if (hasNoData && fabsf(noData) > FLOAT16MAX && !isinf(noData))
+        dst = (float *)allocBuffer(sizeof(float) * n, "prepareFloat16");
+    for (i = 0; i < n; i++)
+    {
+        value = src[i];
+        if (hasNoData && value == noData)
+            value = NAN;
+        else if (fabsf(value) > FLOAT16MAX && !isinf(value))
+            nOver++;
+        if (dst != NULL)
+            dst[i] = value;
+    }
+    if (nOver > 0 && dst != NULL)
+    {
+        releaseData(dst);
+        dst = NULL;
+    }
+    *remapped = dst;
+    return nOver;
+}
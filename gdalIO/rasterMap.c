@@ -0,0 +1,167 @@
+#include "gdal.h"
+#include "cpl_minixml.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "gdalIO/gdalIO/grimpgdal.h"
+#include "mosaicSource/common/common.h"
+
+/*
+  Zero copy read of raw bands written by writeRasterAsVRT/makeVRT. If the requested band is a
+  VRTRawRasterBand with contiguous native-endian pixels, the raw file is mmap'ed (copy-on-write, so the
+  caller can still modify the data) and shares the page cache with other processes; otherwise the
+  band is read into an allocated buffer as readRasterVRT does.
+*/
+
+// Layout of a VRTRawRasterBand as given in the VRT xml
+typedef struct rawBandLayout {
+    char sourceFile[2048];
+    int64_t imageOffset;
+    int64_t pixelOffset;
+    int64_t lineOffset;
+    int msb;
+} rawBandLayout;
+
+static int isLittleEndian()
+{
+    uint16_t one = 1;
+    return *(uint8_t *)&one == 1;
+}
+
+// Find the raw layout for band in the VRT xml. Returns FALSE if it is not a raw band.
+static int getRawBandLayout(GDALDatasetH hDS, char *fileName, int band, rawBandLayout *layout)
+{
+    char **xml = GDALGetMetadata(hDS, "xml:VRT");
+    CPLXMLNode *root, *vrtNode, *node;
+    const char *source;
+    int found = FALSE;
+    //
+    if (xml == NULL || xml[0] == NULL)
+        return FALSE;
+    root = CPLParseXMLString(xml[0]);
+    if (root == NULL)
+        return FALSE;
+    vrtNode = CPLGetXMLNode(root, "=VRTDataset");
+    for (node = (vrtNode != NULL) ? vrtNode->psChild : NULL; node != NULL && found == FALSE; node = node->psNext)
+    {
+        if (node->eType != CXT_Element || strcmp(node->pszValue, "VRTRasterBand") != 0 ||
+            atoi(CPLGetXMLValue(node, "band", "0")) != band)
+            continue;
+        if (strcmp(CPLGetXMLValue(node, "subClass", ""), "VRTRawRasterBand") != 0)
+            break;
+        source = CPLGetXMLValue(node, "SourceFilename", NULL);
+        if (source == NULL)
+            break;
+        // Relative sources are relative to the VRT
+        if (atoi(CPLGetXMLValue(node, "SourceFilename.relativeToVRT", "0")) == 1)
+            source = CPLFormFilename(CPLGetPath(fileName), source, NULL);
+        snprintf(layout->sourceFile, sizeof(layout->sourceFile), "%s", source);
+        layout->imageOffset = atoll(CPLGetXMLValue(node, "ImageOffset", "0"));
+        layout->pixelOffset = atoll(CPLGetXMLValue(node, "PixelOffset", "0"));
+        layout->lineOffset = atoll(CPLGetXMLValue(node, "LineOffset", "0"));
+        layout->msb = strcmp(CPLGetXMLValue(node, "ByteOrder", "LSB"), "MSB") == 0;
+        found = TRUE;
+    }
+    CPLDestroyXMLNode(root);
+    return found;
+}
+
+// Map nBytes of file starting at offset, returning the address of offset.
+static void *mapRawFile(char *file, int64_t offset, size_t nBytes, int advice, rasterView *view)
+{
+    struct stat fileStat;
+    int64_t pageOffset;
+    int fd;
+    //
+    fd = open(file, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size < offset + (int64_t)nBytes)
+    {
+        close(fd);
+        return NULL;
+    }
+    // mmap offsets must be page aligned
+    pageOffset = offset - offset % sysconf(_SC_PAGESIZE);
+    view->mapLength = nBytes + (offset - pageOffset);
+    view->mapBase = mmap(NULL, view->mapLength, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, pageOffset);
+    close(fd);
+    if (view->mapBase == MAP_FAILED)
+    {
+        view->mapBase = NULL;
+        return NULL;
+    }
+    switch (advice)
+    {
+    case MAPADVICE_SEQUENTIAL:
+        madvise(view->mapBase, view->mapLength, MADV_SEQUENTIAL);
+        break;
+    case MAPADVICE_RANDOM:
+        madvise(view->mapBase, view->mapLength, MADV_RANDOM);
+        break;
+    case MAPADVICE_WILLNEED:
+        madvise(view->mapBase, view->mapLength, MADV_WILLNEED);
+        break;
+    default:
+        break;
+    }
+    return (char *)view->mapBase + (offset - pageOffset);
+}
+
+/*
+  Return band of fileName in view, mapped if possible, with the same outputs as readRasterVRT.
+  advice is one of the MAPADVICE_ values. Returns TRUE if mapped, FALSE if read into memory.
+  Release with releaseRasterView.
+*/
+int mapRasterVRT(char *fileName, int band, int *xSize, int *ySize, int *dataType, dictNode **metaDictionary,
+                 int advice, rasterView *view)
+{
+    rawBandLayout layout;
+    GDALRasterBandH hBand;
+    size_t dataTypeSize;
+    CPLErr status;
+    //
+    view->data = NULL;
+    view->mapBase = NULL;
+    view->mapLength = 0;
+    GDALDatasetH hDS = acquireDataSet(fileName);
+    ifNullError(hDS, "mapRasterVRT: Could not open %s\n", fileName);
+    if (band < 1 || band > GDALGetRasterCount(hDS))
+        error("mapRasterVRT: Invalid band %i", band);
+    hBand = GDALGetRasterBand(hDS, band);
+    *dataType = GDALGetRasterDataType(hBand);
+    dataTypeSize = GDALGetDataTypeSizeBytes(*dataType);
+    *xSize = GDALGetRasterBandXSize(hBand);
+    *ySize = GDALGetRasterBandYSize(hBand);
+    // Map only contiguous, native-endian raw bands
+    if (getRawBandLayout(hDS, fileName, band, &layout) == TRUE && layout.pixelOffset == (int64_t)dataTypeSize &&
+        layout.lineOffset == (int64_t)dataTypeSize * (*xSize) &&
+        (layout.msb == !isLittleEndian() || byteSwapWordSize(*dataType) == 0))
+    {
+        view->data = mapRawFile(layout.sourceFile, layout.imageOffset, dataTypeSize * (*xSize) * (size_t)(*ySize),
+                                advice, view);
+    }
+    // Otherwise copy as readRasterVRT
+    if (view->data == NULL)
+    {
+        view->data = allocBuffer(dataTypeSize * (*xSize) * (size_t)(*ySize), "mapRasterVRT");
+        double t0 = ioStatsStart();
+        status = GDALRasterIO(hBand, GF_Read, 0, 0, *xSize, *ySize, view->data, *xSize, *ySize, *dataType, 0, 0);
+        ifNEReturnCode(status, CE_None, "mapRasterVRT: Could not read band data\n");
+        ioStatsStop("mapRasterVRT", IOSTAT_READ, t0, dataTypeSize * (*xSize) * (int64_t)(*ySize));
+    }
+    readDataSetMetaData(hDS, metaDictionary);
+    releaseDataSet(hDS);
+    return view->mapBase != NULL;
+}
+
+void releaseRasterView(rasterView *view)
+{
+    if (view->mapBase != NULL)
+        munmap(view->mapBase, view->mapLength);
+    else
+        releaseData(view->data);
+    view->data = NULL;
+    view->mapBase = NULL;
+    view->mapLength = 0;
+}
@@ -0,0 +1,206 @@
+#include <math.h>
+#include "gdal.h"
+#include "gdalIO/gdalIO/grimpgdal.h"
+#include "mosaicSource/common/common.h"
+
+/*
+  Streaming access to a single band. The data set is opened once (via the handle cache) and arbitrary windows, or the
+  windows of a block grid (native block size by default), are read into a reusable buffer so the
+  memory used is bounded by the window size rather than the full band.
+*/
+
+// Bytes per strip for readRasterVRTAs
+#define STREAMSTRIPBYTES (4 * 1024 * 1024)
+
+// Make sure the stream's internal buffer can hold a window of xWinSize x yWinSize.
+static void *streamBuffer(rasterStream *stream, int xWinSize, int yWinSize)
+{
+    size_t needed = (size_t)xWinSize * (size_t)yWinSize * (size_t)stream->dataTypeSize;
+    if (needed > stream->bufferSize)
+    {
+        CPLFree(stream->buffer);
+        stream->buffer = CPLMalloc(needed);
+        stream->bufferSize = needed;
+        ioStatsAlloc("readRasterWindow", needed);
+    }
+    return stream->buffer;
+}
+
+rasterStream *openRasterStream(char *fileName, int band, dictNode **metaDictionary)
+{
+    rasterStream *stream;
+    int nBands;
+    //
+    GDALDatasetH hDS = acquireDataSet(fileName);
+    ifNullError(hDS, "openRasterStream: Could not open %s\n", fileName);
+    nBands = GDALGetRasterCount(hDS);
+    if (band < 1 || band > nBands)
+        error("openRasterStream: Invalid band %i for %s", band, fileName);
+    stream = (rasterStream *)CPLCalloc(1, sizeof(rasterStream));
+    stream->dataSet = hDS;
+    stream->band = band;
+    stream->hBand = GDALGetRasterBand(hDS, band);
+    ifNullError(stream->hBand, "openRasterStream: Could not get raster band %i\n", band);
+    // Band geometry and type
+    stream->dataType = GDALGetRasterDataType(stream->hBand);
+    stream->dataTypeSize = GDALGetDataTypeSizeBytes(stream->dataType);
+    stream->xSize = GDALGetRasterBandXSize(stream->hBand);
+    stream->ySize = GDALGetRasterBandYSize(stream->hBand);
+    // Default to walking the native block grid
+    GDALGetBlockSize(stream->hBand, &stream->blockXSize, &stream->blockYSize);
+    setRasterStreamBlockSize(stream, stream->blockXSize, stream->blockYSize);
+    // Meta data is optional
+    if (metaDictionary != NULL)
+        readDataSetMetaData(hDS, metaDictionary);
+    return stream;
+}
+
+/*
+  Override the block grid used by nextRasterBlock (e.g., full-width strips for mosaicking).
+  Sizes < 1 fall back to the full band dimension.
+*/
+void setRasterStreamBlockSize(rasterStream *stream, int blockXSize, int blockYSize)
+{
+    stream->blockXSize = (blockXSize < 1 || blockXSize > stream->xSize) ? stream->xSize : blockXSize;
+    stream->blockYSize = (blockYSize < 1 || blockYSize > stream->ySize) ? stream->ySize : blockYSize;
+    stream->nBlocksX = (stream->xSize + stream->blockXSize - 1) / stream->blockXSize;
+    stream->nBlocksY = (stream->ySize + stream->blockYSize - 1) / stream->blockYSize;
+    resetRasterStream(stream);
+}
+
+void resetRasterStream(rasterStream *stream)
+{
+    stream->nextBlock = 0;
+}
+
+/*
+  Read window [xOff, xOff + xWinSize) x [yOff, yOff + yWinSize) in the band's native type.
+  If buffer is NULL, the stream's internal buffer is used, which is only valid until the next read.
+  Windows with no data on disk (e.g., omitted tiles of sparse tiffs) are filled with nodata without I/O.
+*/
+void *readRasterWindow(rasterStream *stream, int xOff, int yOff, int xWinSize, int yWinSize, void *buffer)
+{
+    if (buffer == NULL)
+        buffer = streamBuffer(stream, xWinSize, yWinSize);
+    return readRasterWindowAs(stream, xOff, yOff, xWinSize, yWinSize, stream->dataType, buffer);
+}
+
+/*
+  As readRasterWindow, but converted by GDAL to bufferType as it is read. buffer must be supplied.
+*/
+void *readRasterWindowAs(rasterStream *stream, int xOff, int yOff, int xWinSize, int yWinSize, int bufferType,
+                         void *buffer)
+{
+    CPLErr status;
+    double noData;
+    int hasNoData;
+    //
+    if (xOff < 0 || yOff < 0 || xWinSize < 1 || yWinSize < 1 ||
+        xOff + xWinSize > stream->xSize || yOff + yWinSize > stream->ySize)
+        error("readRasterWindow: Invalid window %i %i %i %i for %i x %i band\n",
+              xOff, yOff, xWinSize, yWinSize, stream->xSize, stream->ySize);
+    if (GDALGetDataCoverageStatus(stream->hBand, xOff, yOff, xWinSize, yWinSize, 0, NULL) ==
+        GDAL_DATA_COVERAGE_STATUS_EMPTY)
+    {
+        noData = GDALGetRasterNoDataValue(stream->hBand, &hasNoData);
+        fillWithNoData(buffer, bufferType, (int64_t)xWinSize * yWinSize, hasNoData ? noData : 0.);
+        return buffer;
+    }
+    double t0 = ioStatsStart();
+    status = GDALRasterIO(stream->hBand, GF_Read, xOff, yOff, xWinSize, yWinSize,
+                          buffer, xWinSize, yWinSize, bufferType, 0, 0);
+    ifNEReturnCode(status, CE_None, "readRasterWindow: Could not read window\n");
+    ioStatsStop("readRasterWindow", IOSTAT_READ, t0, (int64_t)xWinSize * yWinSize * stream->dataTypeSize);
+    return buffer;
+}
+
+/*
+  Return the next block of the grid in row-major order using the internal buffer, with its
+  position and size, or NULL when all blocks have been read.
+*/
+void *nextRasterBlock(rasterStream *stream, int *xOff, int *yOff, int *xWinSize, int *yWinSize)
+{
+    int64_t nBlocks = (int64_t)stream->nBlocksX * stream->nBlocksY;
+    int blockX, blockY;
+    //
+    if (stream->nextBlock >= nBlocks)
+        return NULL;
+    blockX = (int)(stream->nextBlock % stream->nBlocksX);
+    blockY = (int)(stream->nextBlock / stream->nBlocksX);
+    stream->nextBlock++;
+    // Blocks along the right and bottom edges may be partial
+    *xOff = blockX * stream->blockXSize;
+    *yOff = blockY * stream->blockYSize;
+    *xWinSize = (*xOff + stream->blockXSize > stream->xSize) ? stream->xSize - *xOff : stream->blockXSize;
+    *yWinSize = (*yOff + stream->blockYSize > stream->ySize) ? stream->ySize - *yOff : stream->blockYSize;
+    return readRasterWindow(stream, *xOff, *yOff, *xWinSize, *yWinSize, NULL);
+}
+
+// Replace noData with NaN in n float values. Branch free, so it vectorizes.
+static void noDataToNaN(void *data, int dataType, int64_t n, double noData)
+{
+    int64_t i;
+    if (dataType == GDT_Float32)
+    {
+        float *values = (float *)data, value = (float)noData;
+        for (i = 0; i < n; i++)
+            values[i] = (values[i] == value) ? NAN : values[i];
+    }
+    else
+    {
+        double *values = (double *)data;
+        for (i = 0; i < n; i++)
+            values[i] = (values[i] == noData) ? NAN : values[i];
+    }
+}
+
+/*
+  Read band of fileName as outType (e.g., GDT_Float32 from Int16 products), with the other outputs as
+  for readRasterVRT (*dataType is the file's type). The band is read in strips that GDAL converts
+  straight into the result, so there is no native type copy. With NODATA_TONAN (float outputs only),
+  the band's nodata value is replaced with NaN in each strip while it is in cache; NODATA_KEEP converts
+  it like other values. Return the result with releaseData.
+*/
+void *readRasterVRTAs(char *fileName, int band, int outType, int noDataPolicy, int *xSize, int *ySize,
+                      int *dataType, dictNode **metaDictionary)
+{
+    rasterStream *stream;
+    unsigned char *data, *strip;
+    double noData;
+    int hasNoData, xOff, yOff, xWinSize, yWinSize, rows;
+    size_t rowBytes, outTypeSize = GDALGetDataTypeSizeBytes(outType);
+    //
+    if (noDataPolicy == NODATA_TONAN && outType != GDT_Float32 && outType != GDT_Float64)
+        error("readRasterVRTAs: NODATA_TONAN requires a Float32 or Float64 output\n");
+    stream = openRasterStream(fileName, band, metaDictionary);
+    *xSize = stream->xSize;
+    *ySize = stream->ySize;
+    *dataType = stream->dataType;
+    noData = GDALGetRasterNoDataValue(stream->hBand, &hasNoData);
+    // Full width strips
+    rowBytes = outTypeSize * stream->xSize;
+    rows = (int)(STREAMSTRIPBYTES / rowBytes);
+    setRasterStreamBlockSize(stream, stream->xSize, (rows < 1) ? 1 : rows);
+    data = (unsigned char *)allocBuffer(rowBytes * (size_t)stream->ySize, "readRasterVRTAs");
+    for (yOff = 0; yOff < stream->ySize; yOff += yWinSize)
+    {
+        xOff = 0;
+        xWinSize = stream->xSize;
+        yWinSize = (yOff + stream->blockYSize > stream->ySize) ? stream->ySize - yOff : stream->blockYSize;
+        strip = data + rowBytes * yOff;
+        readRasterWindowAs(stream, xOff, yOff, xWinSize, yWinSize, outType, strip);
+        if (noDataPolicy == NODATA_TONAN && hasNoData && !isnan(noData))
+            noDataToNaN(strip, outType, (int64_t)xWinSize * yWinSize, noData);
+    }
+    closeRasterStream(stream);
+    return data;
+}
+
+void closeRasterStream(rasterStream *stream)
+{
+    if (stream == NULL)
+        return;
+    releaseDataSet(stream->dataSet);
+    CPLFree(stream->buffer);
+    CPLFree(stream);
+}
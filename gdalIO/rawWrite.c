@@ -0,0 +1,172 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <errno.h>
+#include "gdalIO/gdalIO/grimpgdal.h"
+#include "mosaicSource/common/common.h"
+
+/*
+  Direct writer for the flat binaries produced by writeRasterAsVRT. The ENVI driver is still used to
+  create the file and its .hdr, and makeVRT the .vrt, so the sidecars are identical, but the pixels are
+  written with pwrite in large chunks from several threads, optionally with O_DIRECT, and byte swapped
+  per chunk so the caller's buffer is never modified.
+*/
+
+#define DIRECTIOALIGN 4096
+
+typedef struct rawWriteJob {
+    const char *src;   // Data to write
+    int64_t fileOffset; // File offset of src[0]
+    size_t nBytes;
+    size_t chunkBytes;
+    int dataType;
+    int byteSwap;
+    int fd;            // Buffered descriptor
+    int directFd;      // O_DIRECT descriptor, or -1
+    int64_t nextChunk; // Shared chunk counter
+    int status;        // 0, or errno of first failure
+} rawWriteJob;
+
+void initRawWriteOptions(rawWriteOptions *options)
+{
+    options->numThreads = 4;
+    options->chunkBytes = 8 * 1024 * 1024;
+    options->directIO = FALSE;
+}
+
+static int pwriteAll(int fd, const char *buf, size_t nBytes, int64_t offset)
+{
+    ssize_t n;
+    while (nBytes > 0)
+    {
+        n = pwrite(fd, buf, nBytes, offset);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        buf += n;
+        offset += n;
+        nBytes -= n;
+    }
+    return 0;
+}
+
+// Each thread claims chunks until all are written.
+static void *rawWriteWorker(void *arg)
+{
+    rawWriteJob *job = (rawWriteJob *)arg;
+    int64_t chunk, nChunks = (job->nBytes + job->chunkBytes - 1) / job->chunkBytes;
+    size_t offset, nBytes, alignedBytes;
+    char *staging = NULL;
+    const char *out;
+    int status, pixelSize = GDALGetDataTypeSizeBytes(job->dataType);
+    //
+    if ((job->byteSwap == TRUE || job->directFd >= 0) &&
+        posix_memalign((void **)&staging, DIRECTIOALIGN, job->chunkBytes) != 0)
+    {
+        __atomic_store_n(&job->status, ENOMEM, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    while ((chunk = __atomic_fetch_add(&job->nextChunk, 1, __ATOMIC_RELAXED)) < nChunks &&
+           __atomic_load_n(&job->status, __ATOMIC_RELAXED) == 0)
+    {
+        offset = chunk * job->chunkBytes;
+        nBytes = (offset + job->chunkBytes > job->nBytes) ? job->nBytes - offset : job->chunkBytes;
+        // Swap or stage into aligned memory as needed, otherwise write straight from src
+        out = job->src + offset;
+        if (job->byteSwap == TRUE)
+            out = byteSwapCopy(out, staging, job->dataType, nBytes / pixelSize);
+        else if (job->directFd >= 0)
+            out = memcpy(staging, out, nBytes);
+        // O_DIRECT needs whole aligned blocks, so any partial tail goes through the buffered descriptor
+        alignedBytes = (job->directFd >= 0) ? nBytes - nBytes % DIRECTIOALIGN : 0;
+        status = pwriteAll(job->directFd, out, alignedBytes, job->fileOffset + offset);
+        if (status == 0)
+            status = pwriteAll(job->fd, out + alignedBytes, nBytes - alignedBytes,
+                               job->fileOffset + offset + alignedBytes);
+        if (status != 0)
+            __atomic_store_n(&job->status, status, __ATOMIC_RELAXED);
+    }
+    free(staging);
+    return NULL;
+}
+
+/*
+  Same arguments and outputs as writeRasterAsVRT, with threading/chunking/O_DIRECT from options
+  (NULL for defaults). /vsi paths are passed through to writeRasterAsVRT.
+*/
+int writeRasterAsVRTDirect(const void *buffer, char *fileName, int xSize, int ySize, int dataType,
+                           int band, double *geoTransform, int byteSwap, dictNode *metaData, rawWriteOptions *options)
+{
+    rawWriteOptions defaultOptions;
+    rawWriteJob job;
+    pthread_t *threads;
+    char *vrtFile, buf[2048];
+    size_t bandBytes;
+    int i, nThreads;
+    //
+    if (strncmp(fileName, "/vsi", 4) == 0)
+        return writeRasterAsVRT((void *)buffer, fileName, xSize, ySize, dataType, band, geoTransform, byteSwap,
+                                metaData);
+    if (options == NULL)
+    {
+        initRawWriteOptions(&defaultOptions);
+        options = &defaultOptions;
+    }
+    // Create the file and .hdr with the ENVI driver, writing no pixels
+    GDALDriverH driver = GDALGetDriverByName("ENVI");
+    ifNullError(driver, "writeRasterAsVRTDirect: Error getting driver");
+    double t0 = ioStatsStart();
+    GDALDatasetH outputDataset = GDALCreate(driver, fileName, xSize, ySize, band, dataType, NULL);
+    ifNullError(outputDataset, "writeRasterAsVRTDirect: Error creating data set");
+    GDALClose(outputDataset);
+    ioStatsStop("writeRasterAsVRTDirect", IOSTAT_OPEN, t0, 0);
+    // Set up the job, with band at its band sequential offset
+    bandBytes = (size_t)xSize * ySize * GDALGetDataTypeSizeBytes(dataType);
+    job.src = (const char *)buffer;
+    job.fileOffset = (int64_t)(band - 1) * bandBytes;
+    job.nBytes = bandBytes;
+    // Chunks are whole pixels and whole O_DIRECT blocks
+    job.chunkBytes = options->chunkBytes - options->chunkBytes % DIRECTIOALIGN;
+    if (job.chunkBytes < DIRECTIOALIGN)
+        job.chunkBytes = DIRECTIOALIGN;
+    job.dataType = dataType;
+    job.byteSwap = byteSwap;
+    job.nextChunk = 0;
+    job.status = 0;
+    job.fd = open(fileName, O_WRONLY);
+    if (job.fd < 0)
+        error("writeRasterAsVRTDirect: Could not open %s", fileName);
+    if (ftruncate(job.fd, job.fileOffset + bandBytes) != 0)
+        error("writeRasterAsVRTDirect: Could not size %s", fileName);
+    job.directFd = -1;
+#ifdef O_DIRECT
+    if (options->directIO == TRUE && job.fileOffset % DIRECTIOALIGN == 0)
+        job.directFd = open(fileName, O_WRONLY | O_DIRECT);
+#endif
+    // Write
+    nThreads = (options->numThreads < 1) ? CPLGetNumCPUs() : options->numThreads;
+    threads = (pthread_t *)CPLMalloc(sizeof(pthread_t) * nThreads);
+    t0 = ioStatsStart();
+    for (i = 0; i < nThreads; i++)
+        if (pthread_create(&threads[i], NULL, rawWriteWorker, &job) != 0)
+            error("writeRasterAsVRTDirect: Could not start writer thread\n");
+    for (i = 0; i < nThreads; i++)
+        pthread_join(threads[i], NULL);
+    CPLFree(threads);
+    if (job.directFd >= 0)
+        close(job.directFd);
+    if (close(job.fd) != 0 && job.status == 0)
+        job.status = errno;
+    ioStatsStop("writeRasterAsVRTDirect", IOSTAT_WRITE, t0, bandBytes);
+    if (job.status != 0)
+        error("writeRasterAsVRTDirect: Failed to write %s (%s)\n", fileName, strerror(job.status));
+    // Now make a vrt file for data set.
+    vrtFile = appendSuff(fileName, ".vrt", buf);
+    makeVRT(vrtFile, xSize, ySize, dataType, &fileName, 1, geoTransform, byteSwap, metaData);
+    invalidateDataSet(vrtFile);
+    invalidateDataSet(fileName);
+    return 0;
+}
@@ -1,106 +1,466 @@
 #include "gdal.h"
-#include "ogr_srs_api.h"
+#include <math.h>
 #include <sys/types.h>
+#include <pthread.h>
 #include "gdalIO/gdalIO/grimpgdal.h"
 #include "mosaicSource/common/common.h"
 
 
-// Get a gdal data set for a given driver type. 
-static GDALDatasetH getDataSetForDriver(char *driverType, const char *filename, void *data,
-                                        int32_t width, int32_t height, int dataType)
+void initTiffWriteOptions(tiffWriteOptions *options)
 {
-    // Get the requested triver
-    GDALDriverH driver = GDALGetDriverByName(driverType);
-    if (driver == NULL)
+    strcpy(options->codec, "DEFLATE");
+    options->level = -1;
+    options->predictor = 0;
+    options->numThreads = 0;
+    options->blockSize = 512;
+    options->tiled = FALSE;
+    options->overviews = TRUE;
+    strcpy(options->overviewResampling, "AVERAGE");
+    options->nOverviewLevels = 0;
+    options->interleave = INTERLEAVE_PIXEL;
+    options->sparse = FALSE;
+    options->maxZError = 0.;
+    options->bandMaxZError = NULL;
+    options->quantize = QUANTIZE_NONE;
+    options->statistics = FALSE;
+    options->histogramBuckets = 0;
+    options->histogramMin = 0.;
+    options->histogramMax = 0.;
+}
+
+/*
+  Build the creation option list for GTiff or COG from the write options. The COG driver uses
+  LEVEL and named predictors, while GTiff uses codec specific level keys and numeric predictors.
+  Free the result with CSLDestroy.
+*/
+char **tiffWriteOptionList(tiffWriteOptions *options, char *driverType, int dataType)
+{
+    char **optionList = NULL;
+    char buf[64];
+    int isCOG = strcmp(driverType, "COG") == 0;
+    //
+    optionList = CSLSetNameValue(optionList, "COMPRESS", options->codec);
+    optionList = CSLSetNameValue(optionList, "BIGTIFF", "IF_NEEDED");
+    // Compression threads
+    if (options->numThreads < 1)
+        optionList = CSLSetNameValue(optionList, "NUM_THREADS", "ALL_CPUS");
+    else
     {
-        error("%s driver not available.\n", driverType);
+        sprintf(buf, "%i", options->numThreads);
+        optionList = CSLSetNameValue(optionList, "NUM_THREADS", buf);
+    }
+    // Codec level
+    if (options->level >= 0)
+    {
+        sprintf(buf, "%i", options->level);
+        if (isCOG)
+            optionList = CSLSetNameValue(optionList, "LEVEL", buf);
+        else if (strcmp(options->codec, "DEFLATE") == 0)
+            optionList = CSLSetNameValue(optionList, "ZLEVEL", buf);
+        else if (strcmp(options->codec, "ZSTD") == 0 || strcmp(options->codec, "LERC_ZSTD") == 0)
+            optionList = CSLSetNameValue(optionList, "ZSTD_LEVEL", buf);
+        else if (strcmp(options->codec, "LERC_DEFLATE") == 0)
+            optionList = CSLSetNameValue(optionList, "ZLEVEL", buf);
     }
-    // Set up data set for MEM, which will be used for COGs
-    if (strcmp(driverType, "MEM") == 0)
+    // Predictor (not used by LERC)
+    if (options->predictor > 0 && strncmp(options->codec, "LERC", 4) != 0)
     {
-        GDALDatasetH dataset = GDALCreate(driver, filename, width, height, 1, dataType, NULL);
-        ifNullError(dataset, "GDAL: Failed to create dataset for %s with driver %s\n", filename, driverType);
-        return dataset;
+        if (options->predictor == 3 && GDALDataTypeIsFloating(dataType) == FALSE)
+            error("tiffWriteOptionList: floating point predictor requires a floating point type\n");
+        if (isCOG)
+            optionList = CSLSetNameValue(optionList, "PREDICTOR",
+                                         options->predictor == 1 ? "NO" : (options->predictor == 2 ? "STANDARD" : "FLOATING_POINT"));
+        else
+        {
+            sprintf(buf, "%i", options->predictor);
+            optionList = CSLSetNameValue(optionList, "PREDICTOR", buf);
+        }
     }
-    if (strcmp(driverType, "GTiff") == 0)
+    // LERC error bound (lossless if not set)
+    if (options->maxZError > 0. && strncmp(options->codec, "LERC", 4) == 0)
     {
-        const char *options[] = {
-            "COMPRESS=DEFLATE",  // Compression for efficient storage
-            "BIGTIFF=IF_NEEDED", // Ensure compatibility with large datasets
-            NULL};
-        GDALDatasetH dataset = GDALCreate(driver, filename, width, height, 1, dataType, (char **)options);
-        ifNullError(dataset, "GDAL: Failed to create dataset for %s with driver %s\n", filename, driverType);
-        return dataset;
+        sprintf(buf, "%.9g", options->maxZError);
+        optionList = CSLSetNameValue(optionList, "MAX_Z_ERROR", buf);
     }
+    // Tiling
+    sprintf(buf, "%i", options->blockSize);
+    if (isCOG)
+        optionList = CSLSetNameValue(optionList, "BLOCKSIZE", buf);
+    else if (options->tiled == TRUE)
+    {
+        optionList = CSLSetNameValue(optionList, "TILED", "YES");
+        optionList = CSLSetNameValue(optionList, "BLOCKXSIZE", buf);
+        optionList = CSLSetNameValue(optionList, "BLOCKYSIZE", buf);
+    }
+    return optionList;
 }
 
-static void flip_data_vertically(void *data, int width, int height, GDALDataType dataType) {
-    size_t rowSize = GDALGetDataTypeSizeBytes(dataType) * width; // Size of a single row in bytes
-    void *tempRow = malloc(rowSize);  // Temporary buffer for swapping rows
+/*
+  Drivers and scratch options held by one writer thread (one per saveAsGeotiffMultiBand call, or per
+  saveAsGeotiffBatch worker), so the write path shares no state between threads and looks drivers up once.
+*/
+typedef struct tiffWriteContext {
+    GDALDriverH memDriver, gtiffDriver, cogDriver;
+    tiffWriteOptions options; // Per-thread copy of the caller's options
+    int alwaysSetNoData;      // Set nodata even if it is DONOTINCLUDENODATA (single-band writers, as before)
+} tiffWriteContext;
 
-    if (tempRow == NULL) {
-        fprintf(stderr, "Memory allocation failed!\n");
-        return;
+static void initTiffWriteContext(tiffWriteContext *context)
+{
+    context->alwaysSetNoData = FALSE;
+    context->memDriver = GDALGetDriverByName("MEM");
+    ifNullError(context->memDriver, "MEM driver not available.\n");
+    context->gtiffDriver = GDALGetDriverByName("GTiff");
+    context->cogDriver = GDALGetDriverByName("COG");
+}
+
+/*
+  GrIMP grids are stored bottom-up while tiffs are north-up, so rows are addressed starting from the last
+  row with a negative line spacing. This avoids flipping (and temporarily modifying) the caller's buffer.
+*/
+static void *lastRow(const void *data, int32_t width, int32_t height, int dataType)
+{
+    return (unsigned char *)data + (size_t)(height - 1) * width * GDALGetDataTypeSizeBytes(dataType);
+}
+
+/*
+  Wrap the caller's band buffers in a MEM data set. Each band aliases its buffer (DATAPOINTER) so the
+  rasters are never copied before GDALCreateCopy, reading bottom-up rows north-up with a negative LINEOFFSET.
+*/
+static GDALDatasetH getMemDataSetForBands(GDALDriverH driver, const char *filename, const void **bands, int nBands,
+                                          int32_t width, int32_t height, int dataType)
+{
+    char pointerBuf[64], dataPointer[128], pixelOffset[64], lineOffset[64];
+    int i;
+    GDALDatasetH dataset = GDALCreate(driver, "", width, height, 0, dataType, NULL);
+    ifNullError(dataset, "GDAL: Failed to create MEM dataset for %s\n", filename);
+    sprintf(pixelOffset, "PIXELOFFSET=%i", GDALGetDataTypeSizeBytes(dataType));
+    sprintf(lineOffset, "LINEOFFSET=%lld", -(long long)GDALGetDataTypeSizeBytes(dataType) * width);
+    for (i = 0; i < nBands; i++)
+    {
+        memset(pointerBuf, 0, sizeof(pointerBuf));
+        CPLPrintPointer(pointerBuf, lastRow(bands[i], width, height, dataType), sizeof(pointerBuf) - 1);
+        sprintf(dataPointer, "DATAPOINTER=%s", pointerBuf);
+        char *bandOptions[] = {dataPointer, pixelOffset, lineOffset, NULL};
+        CPLErr returnCode = GDALAddBand(dataset, dataType, bandOptions);
+        ifNEReturnCode(returnCode, CE_None, "GDAL: Failed to wrap band %i buffer for %s\n", i + 1, filename);
     }
+    return dataset;
+}
 
-    unsigned char *dataPtr = (unsigned char *)data;
-    for (int i = 0; i < height / 2; i++) {
-        unsigned char *topRow = dataPtr + i * rowSize;
-        unsigned char *bottomRow = dataPtr + (height - i - 1) * rowSize;
-        // Swap rows
-        memcpy(tempRow, topRow, rowSize);
-        memcpy(topRow, bottomRow, rowSize);
-        memcpy(bottomRow, tempRow, rowSize);
+/*
+  Sparse GTiff output. Tiles are walked in file order, and for each band the tile is written only if it
+  has data, so empty tiles are neither copied nor compressed, and are omitted from the file (SPARSE_OK).
+  Readers get nodata (or 0 without a nodata value) for them. memDataset supplies the georeferencing,
+  meta data, nodata values, and descriptions. stats (or NULL) has the band histograms.
+*/
+static void writeSparseTiff(GDALDriverH driver, const char *filename, GDALDatasetH memDataset, const void **bands,
+                            int nBands, int32_t width, int32_t height, int dataType, char **optionList,
+                            bandStatistics *stats)
+{
+    GDALRasterBandH memBand, band;
+    double geoTransform[6], *noData;
+    int i, x0, y0, nx, ny, blockXSize, blockYSize, hasNoData;
+    int64_t nTiles = 0, nSkipped = 0, bytesWritten = 0;
+    int pixelSize = GDALGetDataTypeSizeBytes(dataType);
+    GSpacing lineSpace = -(GSpacing)pixelSize * width;
+    const unsigned char *window;
+    //
+    double t0 = ioStatsStart();
+    GDALDatasetH dataset = GDALCreate(driver, filename, width, height, nBands, dataType, optionList);
+    ifNullError(dataset, "GDAL: Failed to create dataset for %s with driver GTiff\n", filename);
+    ioStatsStop("saveAsGeotiff", IOSTAT_OPEN, t0, 0);
+    // Copy the georeferencing and meta data from the MEM data set
+    if (GDALGetGeoTransform(memDataset, geoTransform) == CE_None)
+        GDALSetGeoTransform(dataset, geoTransform);
+    GDALSetProjection(dataset, GDALGetProjectionRef(memDataset));
+    GDALSetMetadata(dataset, GDALGetMetadata(memDataset, NULL), NULL);
+    noData = (double *)CPLMalloc(sizeof(double) * nBands);
+    for (i = 0; i < nBands; i++)
+    {
+        memBand = GDALGetRasterBand(memDataset, i + 1);
+        band = GDALGetRasterBand(dataset, i + 1);
+        noData[i] = GDALGetRasterNoDataValue(memBand, &hasNoData);
+        if (hasNoData)
+            GDALSetRasterNoDataValue(band, noData[i]);
+        else
+            noData[i] = 0.;
+        GDALSetDescription(band, GDALGetDescription(memBand));
+        GDALSetMetadata(band, GDALGetMetadata(memBand, NULL), NULL);
+        GDALSetRasterScale(band, GDALGetRasterScale(memBand, NULL));
+        GDALSetRasterOffset(band, GDALGetRasterOffset(memBand, NULL));
+        if (stats != NULL)
+            setBandHistogram(band, &stats[i]);
+    }
+    // Tiles outer and bands inner, so pixel interleaved blocks are completed before they are flushed
+    GDALGetBlockSize(GDALGetRasterBand(dataset, 1), &blockXSize, &blockYSize);
+    t0 = ioStatsStart();
+    for (y0 = 0; y0 < height; y0 += blockYSize)
+    {
+        ny = (y0 + blockYSize > height) ? height - y0 : blockYSize;
+        for (x0 = 0; x0 < width; x0 += blockXSize)
+        {
+            nx = (x0 + blockXSize > width) ? width - x0 : blockXSize;
+            for (i = 0; i < nBands; i++)
+            {
+                // Row y0 of the tiff is y0 rows down from the last row of the bottom-up buffer
+                window = (const unsigned char *)lastRow(bands[i], width, height, dataType) + y0 * lineSpace +
+                         (size_t)x0 * pixelSize;
+                nTiles++;
+                if (windowIsNoData(window, lineSpace, nx, ny, dataType, noData[i]) == TRUE)
+                {
+                    nSkipped++;
+                    continue;
+                }
+                CPLErr returnCode = GDALRasterIOEx(GDALGetRasterBand(dataset, i + 1), GF_Write, x0, y0, nx, ny,
+                                                   (void *)window, nx, ny, dataType, 0, lineSpace, NULL);
+                ifNEReturnCode(returnCode, CE_None, "Failed to write raster data.\n");
+                bytesWritten += (int64_t)nx * ny * pixelSize;
+            }
+        }
     }
+    CPLFree(noData);
+    // Closing flushes the remaining compressed blocks
+    GDALClose(dataset);
+    ioStatsStop("saveAsGeotiff", IOSTAT_COMPRESS, t0, bytesWritten);
+    ioStatsLog("saveAsGeotiff: skipped %lld of %lld empty tiles\n", (long long)nSkipped, (long long)nTiles);
+}
+
+// Maximum error for band i.
+static double bandMaxZError(tiffWriteOptions *options, int i)
+{
+    return (options->bandMaxZError != NULL) ? options->bandMaxZError[i] : options->maxZError;
+}
 
-    free(tempRow);
+/*
+  Build the COG overviews on the MEM data set wrapping the caller's buffer, so they are computed from
+  the full resolution data already in memory rather than re-read by the COG driver. Levels default to
+  powers of 2 until the overview fits in a block, as for OVERVIEWS=AUTO. The band's nodata value is set
+  first so nodata pixels are excluded from averages. GDAL_NUM_THREADS parallelizes the computation.
+*/
+static void buildMemOverviews(GDALDatasetH dataset, int32_t width, int32_t height, tiffWriteOptions *options)
+{
+    const char *resampling[] = {"AVERAGE", "NEAREST", "MODE", "RMS", NULL};
+    int levels[MAXOVERVIEWS], nLevels = 0, factor, i;
+    char threads[32];
+    //
+    for (i = 0; resampling[i] != NULL && strcmp(resampling[i], options->overviewResampling) != 0; i++);
+    if (resampling[i] == NULL)
+        error("buildMemOverviews: Invalid overview resampling %s\n", options->overviewResampling);
+    // Levels
+    if (options->nOverviewLevels > 0)
+    {
+        nLevels = (options->nOverviewLevels > MAXOVERVIEWS) ? MAXOVERVIEWS : options->nOverviewLevels;
+        memcpy(levels, options->overviewLevels, sizeof(int) * nLevels);
+    }
+    else
+    {
+        for (factor = 2; nLevels < MAXOVERVIEWS &&
+                         ((width + factor / 2 - 1) / (factor / 2) > options->blockSize ||
+                          (height + factor / 2 - 1) / (factor / 2) > options->blockSize);
+             factor *= 2)
+            levels[nLevels++] = factor;
+    }
+    if (nLevels == 0)
+        return;
+    // Threads
+    if (options->numThreads < 1)
+        strcpy(threads, "ALL_CPUS");
+    else
+        sprintf(threads, "%i", options->numThreads);
+    double t0 = ioStatsStart();
+    CPLSetThreadLocalConfigOption("GDAL_NUM_THREADS", threads);
+    CPLErr returnCode = GDALBuildOverviews(dataset, options->overviewResampling, nLevels, levels, 0, NULL, NULL, NULL);
+    CPLSetThreadLocalConfigOption("GDAL_NUM_THREADS", NULL);
+    ifNEReturnCode(returnCode, CE_None, "buildMemOverviews: Failed to build overviews\n");
+    ioStatsStop("saveAsGeotiff", IOSTAT_COMPRESS, t0, 0);
 }
+
+static void writeGeotiff(tiffWriteContext *context, const char *filename, const void **bands,
+                         const char **bandDescriptions, float *noDataValues, int nBands, int32_t width,
+                         int32_t height, double *geotransform, const char *epsg_code, dictNode *metaData,
+                         char *driverType, int32_t dataType, tiffWriteOptions *options);
+
 // Write data to a geo tiff. Adapted from an original created with ChatGPT
-void saveAsGeotiff(const char *filename, void *data, int32_t width, int32_t height, double *geotransform,
+void saveAsGeotiff(const char *filename, const void *data, int32_t width, int32_t height, double *geotransform,
                    const char *epsg_code, dictNode *metaData, char *driverType, int32_t dataType, float noDataValue)
+{
+    saveAsGeotiffWithOptions(filename, data, width, height, geotransform, epsg_code, metaData, driverType,
+                             dataType, noDataValue, NULL);
+}
+
+// As saveAsGeotiff, but with codec, level, predictor, and thread count from options (NULL for defaults).
+void saveAsGeotiffWithOptions(const char *filename, const void *data, int32_t width, int32_t height, double *geotransform,
+                              const char *epsg_code, dictNode *metaData, char *driverType, int32_t dataType,
+                              float noDataValue, tiffWriteOptions *options)
+{
+    tiffWriteContext context;
+    initTiffWriteContext(&context);
+    context.alwaysSetNoData = TRUE;
+    writeGeotiff(&context, filename, &data, NULL, &noDataValue, 1, width, height, geotransform, epsg_code, metaData,
+                 driverType, dataType, options);
+}
+
+// TRUE if band i is written with a nodata value.
+static int bandHasNoData(tiffWriteContext *context, float *noDataValues, int i)
+{
+    return noDataValues != NULL && (context->alwaysSetNoData || noDataValues[i] != (float)DONOTINCLUDENODATA);
+}
+
+/*
+  Write nBands bottom-up buffers of the same size and type as one GTiff or COG, so compression and
+  overviews run once and readers open one file. bandDescriptions (or NULL) and noDataValues give
+  per-band descriptions and nodata values (DONOTINCLUDENODATA for none). The layout of multi-band
+  files is set by options->interleave (INTERLEAVE_BAND or INTERLEAVE_PIXEL).
+  The buffers are wrapped in a MEM data set and written with GDALCreateCopy for either driver, or
+  tile by tile by writeSparseTiff for sparse GTiffs.
+  Float32 bands can be stored lossy (options->quantize): as Float16 (NBITS=16), or as int16 scaled to
+  each band's maxZError, with the scale and offset in the band's metadata. Float16 bands with values
+  beyond FLOAT16MAX are an error, and nodata beyond it is stored as NaN. LERC codecs use the smallest
+  band maxZError as MAX_Z_ERROR.
+  With options->statistics, each band's statistics (and optional histogram) are computed from the
+  buffers and stored with the file, so no separate stats pass is needed.
+*/
+static void writeGeotiff(tiffWriteContext *context, const char *filename, const void **bands,
+                         const char **bandDescriptions, float *noDataValues, int nBands, int32_t width,
+                         int32_t height, double *geotransform, const char *epsg_code, dictNode *metaData,
+                         char *driverType, int32_t dataType, tiffWriteOptions *options)
 {
     GDALDatasetH dataset;
+    GDALRasterBandH band;
+    tiffWriteOptions defaultOptions, sparseOptions;
+    int16_t **quantized = NULL;
+    float **remapped = NULL;
+    const void **float16Bands = NULL;
+    double *scales = NULL, *offsets = NULL, maxZError, noData;
+    bandStatistics *stats = NULL;
+    char buf[64];
+    int i, sparseTiff, hasNoData;
     //
-    // Get the data set
-    if (strcmp(driverType, "COG") == 0)
+    if (options == NULL)
     {
-        dataset = getDataSetForDriver("MEM", "", data, width, height, dataType);
+        initTiffWriteOptions(&defaultOptions);
+        options = &defaultOptions;
     }
-    else
+    // Sparse GTiffs must be tiled
+    sparseTiff = options->sparse == TRUE && strcmp(driverType, "GTiff") == 0;
+    if (sparseTiff == TRUE && options->tiled == FALSE)
     {
-        dataset = getDataSetForDriver(driverType, filename, data, width, height, dataType);
+        sparseOptions = *options;
+        sparseOptions.tiled = TRUE;
+        options = &sparseOptions;
     }
+    if (strcmp(driverType, "COG") != 0 && strcmp(driverType, "GTiff") != 0)
+        error("saveAsGeotiff: Unsupported driver %s\n", driverType);
+    GDALDriverH driver = strcmp(driverType, "COG") == 0 ? context->cogDriver : context->gtiffDriver;
+    if (driver == NULL)
+    {
+        error("%s driver not available.\n", driverType);
+    }
+    if (options->quantize != QUANTIZE_NONE && dataType != GDT_Float32)
+        error("saveAsGeotiff: Quantization requires Float32 data\n");
+    // Quantize to scaled int16 copies, which are written instead
+    if (options->quantize == QUANTIZE_INT16)
+    {
+        quantized = (int16_t **)CPLMalloc(sizeof(int16_t *) * nBands);
+        scales = (double *)CPLMalloc(sizeof(double) * nBands);
+        offsets = (double *)CPLMalloc(sizeof(double) * nBands);
+        for (i = 0; i < nBands; i++)
+        {
+            hasNoData = bandHasNoData(context, noDataValues, i);
+            quantized[i] = quantizeToInt16((const float *)bands[i], (int64_t)width * height,
+                                           hasNoData ? noDataValues[i] : 0., hasNoData, bandMaxZError(options, i),
+                                           &scales[i], &offsets[i]);
+        }
+        bands = (const void **)quantized;
+        dataType = GDT_Int16;
+    }
+    // Float16 keeps the data, but nodata may need remapping to fit
+    if (options->quantize == QUANTIZE_FLOAT16)
+    {
+        remapped = (float **)CPLCalloc(nBands, sizeof(float *));
+        float16Bands = (const void **)CPLMalloc(sizeof(void *) * nBands);
+        for (i = 0; i < nBands; i++)
+        {
+            hasNoData = bandHasNoData(context, noDataValues, i);
+            if (prepareFloat16((const float *)bands[i], (int64_t)width * height, hasNoData ? noDataValues[i] : 0.f,
+                               hasNoData, &remapped[i]) > 0)
+                error("saveAsGeotiff: Band %i of %s has values beyond the Float16 range (%g)\n", i + 1, filename,
+                      FLOAT16MAX);
+            float16Bands[i] = (remapped[i] != NULL) ? remapped[i] : bands[i];
+        }
+        bands = float16Bands;
+    }
+    // MEM data set wrapping the bands
+    double t0 = ioStatsStart();
+    dataset = getMemDataSetForBands(context->memDriver, filename, bands, nBands, width, height, dataType);
+    ioStatsStop("saveAsGeotiff", IOSTAT_OPEN, t0, 0);
     //
     // Set geotransform
     CPLErr returnCode  = GDALSetGeoTransform(dataset, geotransform);
     ifNEReturnCode(returnCode,  CE_None, "GDAL: Failed to set geotransform for filename %s\n", filename);
-    // Set projection using EPSG code
-    OGRSpatialReferenceH srs = OSRNewSpatialReference(NULL);
-    if (OSRImportFromEPSG(srs, atoi(epsg_code)) != OGRERR_NONE)
-    {
-        fprintf(stderr, "Failed to import EPSG code, trying wkt.\n");
-    }
+    // Set projection from the cached WKT
+    const char *wkt = getProjectionWKT(epsg_code);
+    if (wkt == NULL)
+        fprintf(stderr, "Failed to import EPSG code %s, no projection set.\n", epsg_code != NULL ? epsg_code : "");
     else
-    {
-        char *wkt = NULL;
-        OSRExportToWkt(srs, &wkt);
         GDALSetProjection(dataset, wkt);
-        CPLFree(wkt);
+    //
+    // Per band nodata and descriptions (nodata must be set before overviews are built)
+    for (i = 0; i < nBands; i++)
+    {
+        band = GDALGetRasterBand(dataset, i + 1);
+        ifNullError(band, "Failed to get raster band.\n");
+        if (quantized != NULL)
+            GDALSetRasterNoDataValue(band, QUANTIZENODATA);
+        else if (remapped != NULL && remapped[i] != NULL)
+            GDALSetRasterNoDataValue(band, NAN);
+        else if (bandHasNoData(context, noDataValues, i))
+            GDALSetRasterNoDataValue(band, noDataValues[i]);
+        if (bandDescriptions != NULL && bandDescriptions[i] != NULL)
+            GDALSetDescription(band, bandDescriptions[i]);
+        // Record the quantization, so readers can unscale
+        if (quantized != NULL)
+        {
+            GDALSetRasterScale(band, scales[i]);
+            GDALSetRasterOffset(band, offsets[i]);
+            GDALSetMetadataItem(band, "QUANTIZATION", "INT16", NULL);
+        }
+        else if (options->quantize == QUANTIZE_FLOAT16)
+        {
+            // Carried to the COG driver through the source band
+            GDALSetMetadataItem(band, "NBITS", "16", "IMAGE_STRUCTURE");
+            GDALSetMetadataItem(band, "QUANTIZATION", "FLOAT16", NULL);
+        }
+        // The bound is only advertised if it was applied (LERC, or int16 quantization, whose scale may
+        // have had to be coarser)
+        maxZError = bandMaxZError(options, i);
+        if (quantized != NULL && maxZError > 0.)
+            maxZError = fmax(maxZError, 0.5 * scales[i]);
+        if (maxZError > 0. && (strncmp(options->codec, "LERC", 4) == 0 || quantized != NULL))
+        {
+            sprintf(buf, "%.9g", maxZError);
+            GDALSetMetadataItem(band, "MAX_Z_ERROR", buf, NULL);
+        }
     }
-    OSRDestroySpatialReference(srs);
     //
-    // Write data to the raster band
-    GDALRasterBandH band = GDALGetRasterBand(dataset, 1);
-    ifNullError(band, "Failed to get raster band.\n");
-    // Get set the nod data value
-    GDALSetRasterNoDataValue(band, noDataValue);
-    // flip vertically for tiff output
-    flip_data_vertically(data, width, height, dataType);
-    // Write the raster bands
-    returnCode = GDALRasterIO(band, GF_Write, 0, 0, width, height, data, width, height, dataType, 0, 0);
-    // May not be needed in many cases, but flip back to original.
-    flip_data_vertically(data, width, height, dataType);
-    ifNEReturnCode(returnCode,  CE_None, "Failed to write raster data.\n");
+    // Statistics of the values as stored
+    if (options->statistics == TRUE)
+    {
+        t0 = ioStatsStart();
+        stats = (bandStatistics *)CPLCalloc(nBands, sizeof(bandStatistics));
+        for (i = 0; i < nBands; i++)
+        {
+            band = GDALGetRasterBand(dataset, i + 1);
+            noData = GDALGetRasterNoDataValue(band, &hasNoData);
+            computeBandStatistics(bands[i], (int64_t)width * height, dataType, noData, hasNoData,
+                                  options->histogramBuckets, options->histogramMin, options->histogramMax,
+                                  &stats[i]);
+            setBandStatistics(band, &stats[i]);
+        }
+        ioStatsStop("saveAsGeotiff", IOSTAT_READ, t0,
+                    (int64_t)width * height * GDALGetDataTypeSizeBytes(dataType) * nBands);
+    }
     //
     // Add metadata
     if (metaData != NULL)
@@ -109,23 +469,90 @@ void saveAsGeotiff(const char *filename, void *data, int32_t width, int32_t heig
         writeDataSetMetaData(dataset, metaData);
     }
     //
-    // Extra stuff to create COGs by copying from memory
+    // Creation options
+    char **optionList = tiffWriteOptionList(options, driverType, dataType);
+    if (nBands > 1)
+        optionList = CSLSetNameValue(optionList, "INTERLEAVE", options->interleave == INTERLEAVE_BAND ? "BAND" : "PIXEL");
+    // Lossy options. The LERC bound applies to all bands, so use the tightest. Quantized data are
+    // already within their bounds, so are compressed losslessly.
+    if (strncmp(options->codec, "LERC", 4) == 0)
+    {
+        for (i = 0, maxZError = bandMaxZError(options, 0); i < nBands; i++)
+            maxZError = (bandMaxZError(options, i) < maxZError) ? bandMaxZError(options, i) : maxZError;
+        optionList = CSLSetNameValue(optionList, "MAX_Z_ERROR", NULL);
+        if (maxZError > 0. && quantized == NULL)
+        {
+            sprintf(buf, "%.9g", maxZError);
+            optionList = CSLSetNameValue(optionList, "MAX_Z_ERROR", buf);
+        }
+    }
+    if (options->quantize == QUANTIZE_FLOAT16 && strcmp(driverType, "GTiff") == 0)
+        optionList = CSLSetNameValue(optionList, "NBITS", "16");
+    // Omit empty tiles
+    if (options->sparse == TRUE)
+        optionList = CSLSetNameValue(optionList, "SPARSE_OK", "TRUE");
+    // Extra stuff to create COGs
     if (strcmp(driverType, "COG") == 0)
     {
-        const char *options[] = {
-            "COMPRESS=DEFLATE",
-            "BIGTIFF=IF_NEEDED",
-            "BLOCKSIZE=512",
-            "OVERVIEWS=AUTO",
-            NULL};
-        GDALDriverH cogDriver = GDALGetDriverByName(driverType);
-        GDALDatasetH cogDataset = GDALCreateCopy(cogDriver, filename, dataset, FALSE, (char **)options, NULL, NULL);
-        ifNullError(cogDataset, "Error: Failed to create COG dataset.\n");
-        // Clean up
-        GDALClose(cogDataset);
+        if (options->overviews == TRUE)
+        {
+            buildMemOverviews(dataset, width, height, options);
+            optionList = CSLSetNameValue(optionList, "OVERVIEWS", "FORCE_USE_EXISTING");
+        }
+        else
+            optionList = CSLSetNameValue(optionList, "OVERVIEWS", "NONE");
+        optionList = CSLSetNameValue(optionList, "OVERVIEW_RESAMPLING", options->overviewResampling);
+    }
+    // Copy from memory, compressing and writing the file
+    if (sparseTiff == TRUE)
+        writeSparseTiff(driver, filename, dataset, bands, nBands, width, height, dataType, optionList, stats);
+    else
+    {
+        t0 = ioStatsStart();
+        GDALDatasetH outDataset = GDALCreateCopy(driver, filename, dataset, FALSE, optionList, NULL, NULL);
+        ifNullError(outDataset, "Error: Failed to create %s dataset %s.\n", driverType, filename);
+        for (i = 0; stats != NULL && i < nBands; i++)
+            setBandHistogram(GDALGetRasterBand(outDataset, i + 1), &stats[i]);
+        GDALClose(outDataset);
+        ioStatsStop("saveAsGeotiff", IOSTAT_COMPRESS, t0,
+                    (int64_t)width * height * GDALGetDataTypeSizeBytes(dataType) * nBands);
     }
+    CSLDestroy(optionList);
     // Clean up
+    t0 = ioStatsStart();
     GDALClose(dataset);
+    ioStatsStop("saveAsGeotiff", IOSTAT_CLOSE, t0, 0);
+    for (i = 0; stats != NULL && i < nBands; i++)
+        CPLFree(stats[i].histogram);
+    CPLFree(stats);
+    if (quantized != NULL)
+    {
+        for (i = 0; i < nBands; i++)
+            releaseData(quantized[i]);
+        CPLFree(quantized);
+        CPLFree(scales);
+        CPLFree(offsets);
+    }
+    if (remapped != NULL)
+    {
+        for (i = 0; i < nBands; i++)
+            releaseData(remapped[i]);
+        CPLFree(remapped);
+        CPLFree(float16Bands);
+    }
+    invalidateDataSet(filename);
+}
+
+// Write nBands as one file (see writeGeotiff). epsg_code is an EPSG code or from getProjectionCodeFromParams.
+void saveAsGeotiffMultiBand(const char *filename, const void **bands, const char **bandDescriptions,
+                            float *noDataValues, int nBands, int32_t width, int32_t height, double *geotransform,
+                            const char *epsg_code, dictNode *metaData, char *driverType, int32_t dataType,
+                            tiffWriteOptions *options)
+{
+    tiffWriteContext context;
+    initTiffWriteContext(&context);
+    writeGeotiff(&context, filename, bands, bandDescriptions, noDataValues, nBands, width, height, geotransform,
+                 epsg_code, metaData, driverType, dataType, options);
 }
 
 void computeGeoTransform(double geoTransform[6], double x0, double y0, 
@@ -156,19 +583,6 @@ char *timeStampMeta()
     return timeStampCopy;
 }
 
-const char *getEPSGFromProjectionParams(double rot, double slat, int32_t hemisphere)
-{
-    if (rot == 45 && slat == 70 && hemisphere == NORTH)
-    {
-        return "3413";
-    }
-    if (rot == 0. && slat == 71. && hemisphere == SOUTH)
-    {
-        return "3031";
-    }
-    error("Could not determine epgs from rot=%lf slat=%lf hemisphere=%i");
-}
-
 static const char *getFileSuffix(const char *filename)
 {
     // Find the last dot in the filename
@@ -182,7 +596,7 @@ static const char *getFileSuffix(const char *filename)
     return dot + 1;
 }
 
-static const char *getSuffixBeforeTif(const char *filename)
+static const char *getSuffixBeforeTif(const char *filename, char *suffix, size_t suffixSize)
 {
     // Find the last occurrence of ".tif"
     const char *tif = strstr(filename, ".tif");
@@ -202,10 +616,9 @@ static const char *getSuffixBeforeTif(const char *filename)
     {
         return NULL;
     }
-    // Allocate a string to hold the suffix
+    // Copy the suffix to the caller's buffer
     size_t suffixLength = tif - lastDot;
-    static char suffix[256]; // Ensure enough space
-    if (suffixLength >= sizeof(suffix))
+    if (suffixLength >= suffixSize)
     {
         return NULL; // Prevent overflow
     }
@@ -214,18 +627,23 @@ static const char *getSuffixBeforeTif(const char *filename)
     return suffix;
 }
 
-static void setBandDescriptionAndNoData(GDALDatasetH vrtDataset, const char *filename, int bandIndex, float noDataValue)
+// Set the band description from filename, and the nodata value unless noDataValue is NULL.
+static void setBandDescriptionAndNoData(GDALDatasetH vrtDataset, const char *filename, int bandIndex,
+                                        const float *noDataValue)
 {
-    const char *description = getSuffixBeforeTif(filename);
+    char suffix[256];
+    const char *description = getSuffixBeforeTif(filename, suffix, sizeof(suffix));
     GDALRasterBandH band = GDALGetRasterBand(vrtDataset, bandIndex);
     ifNullError(band,"Failed to get band %d\n", bandIndex);
     // Set the "Description" metadata for the band
     CPLErr returnCode  = GDALSetMetadataItem(band, "Description", description, NULL);
     ifNEReturnCode(returnCode,  CE_None, "Failed to set Description for band %d\n", bandIndex);
     // Set the no data value for the band
-    GDALSetRasterNoDataValue(band, noDataValue);
+    if (noDataValue != NULL)
+        GDALSetRasterNoDataValue(band, *noDataValue);
 }
 
+// Stack the tiffs in bands into vrtFile, with nodata values from noDataValues (NULL for none).
 int makeTiffVRT(char *vrtFile, const char **bands, int nBands, float *noDataValues, dictNode *metaData)
 {
     // Create GDALBuildVRT options
@@ -240,26 +658,30 @@ int makeTiffVRT(char *vrtFile, const char **bands, int nBands, float *noDataValu
     
     for (int i = 0; i < nBands; i++)
     {
+        double t0 = ioStatsStart();
         pahInputDatasets[i] = GDALOpen(bands[i], GA_ReadOnly);
         ifNullError(pahInputDatasets[i], "Failed to open input file: %s\n", bands[i]);
+        ioStatsStop("makeTiffVRT", IOSTAT_OPEN, t0, 0);
     }
     // Build VRT
     GDALDatasetH vrtDataset = GDALBuildVRT(vrtFile, nBands, pahInputDatasets, bands, psOptions, NULL);
-    
+    // Check that it worked
+    if (vrtDataset == NULL)
+    {
+        error("GDALBuildVRT failed\n");
+    }
     // Add the suffix of the file name the description
     for (int i = 1; i <= nBands; i++)
     {
-        setBandDescriptionAndNoData(vrtDataset, bands[i - 1], i, noDataValues[i - 1]);
+        setBandDescriptionAndNoData(vrtDataset, bands[i - 1], i, noDataValues != NULL ? &noDataValues[i - 1] : NULL);
     }
     // Add the meta data
     writeDataSetMetaData(vrtDataset, metaData);
-    // Check that it worked
-    if (vrtDataset == NULL)
-    {
-        error("GDALBuildVRT failed\n");
-    }
     // Save the VRT dataset to disk
+    double t0 = ioStatsStart();
     GDALClose(vrtDataset);
+    ioStatsStop("makeTiffVRT", IOSTAT_CLOSE, t0, 0);
+    invalidateDataSet(vrtFile);
     // Cleanup input datasets
     for (int i = 0; i < nBands; i++)
     {
@@ -268,6 +690,202 @@ int makeTiffVRT(char *vrtFile, const char **bands, int nBands, float *noDataValu
     CPLFree(pahInputDatasets);
     // Free options
     GDALBuildVRTOptionsFree(psOptions);
-    // Cleanup
-    GDALDestroyDriverManager();
+    // The driver manager is left alive so later GDAL calls (and batches) don't pay re-registration.
+    return 0;
+}
+
+typedef struct tiffVRTBatch {
+    tiffVRTJob *jobs;
+    int nJobs;
+    int nextJob; // Shared job counter
+} tiffVRTBatch;
+
+static void *tiffVRTWorker(void *arg)
+{
+    tiffVRTBatch *batch = (tiffVRTBatch *)arg;
+    tiffVRTJob *job;
+    int i;
+    while ((i = __atomic_fetch_add(&batch->nextJob, 1, __ATOMIC_RELAXED)) < batch->nJobs)
+    {
+        job = &batch->jobs[i];
+        makeTiffVRT(job->vrtFile, job->bands, job->nBands, job->noDataValues, job->metaData);
+    }
+    return NULL;
+}
+
+/*
+  Build many VRT stacks at once. Jobs are handed out to nThreads threads (< 1 for all cores), so the
+  inputs of different products are opened concurrently.
+*/
+int makeTiffVRTBatch(tiffVRTJob *jobs, int nJobs, int nThreads)
+{
+    tiffVRTBatch batch = {jobs, nJobs, 0};
+    pthread_t *threads;
+    int i;
+    //
+    if (nThreads < 1)
+        nThreads = CPLGetNumCPUs();
+    if (nThreads > nJobs)
+        nThreads = nJobs;
+    if (nThreads <= 1)
+    {
+        tiffVRTWorker(&batch);
+        return 0;
+    }
+    threads = (pthread_t *)CPLMalloc(sizeof(pthread_t) * nThreads);
+    for (i = 0; i < nThreads; i++)
+        if (pthread_create(&threads[i], NULL, tiffVRTWorker, &batch) != 0)
+            error("makeTiffVRTBatch: Could not start thread\n");
+    for (i = 0; i < nThreads; i++)
+        pthread_join(threads[i], NULL);
+    CPLFree(threads);
+    return 0;
+}
+
+/*
+  Work-stealing queues for saveAsGeotiffBatch. Each worker starts with a contiguous run of tiles, so
+  neighbouring tiles (usually similar in cost) go to the same thread. A worker whose run is done steals
+  the back half of the largest remaining run.
+*/
+typedef struct tileQueue {
+    pthread_mutex_t mutex;
+    int next, end; // Tiles [next, end) not yet started
+} tileQueue;
+
+typedef struct tiffTileBatch {
+    tiffTileJob *jobs;
+    tileQueue *queues;
+    int nThreads;
+} tiffTileBatch;
+
+typedef struct tiffTileWorker {
+    tiffTileBatch *batch;
+    int id;
+} tiffTileWorker;
+
+// Next tile for worker id, or -1 when all have been started.
+static int nextTile(tiffTileBatch *batch, int id)
+{
+    tileQueue *own = &batch->queues[id], *victim;
+    int i, job = -1, most, remaining, start, end;
+    //
+    pthread_mutex_lock(&own->mutex);
+    if (own->next < own->end)
+        job = own->next++;
+    pthread_mutex_unlock(&own->mutex);
+    while (job < 0)
+    {
+        // Largest run (a hint; rechecked under the victim's lock)
+        victim = NULL;
+        for (i = 0, most = 0; i < batch->nThreads; i++)
+        {
+            if (i == id)
+                continue;
+            pthread_mutex_lock(&batch->queues[i].mutex);
+            remaining = batch->queues[i].end - batch->queues[i].next;
+            pthread_mutex_unlock(&batch->queues[i].mutex);
+            if (remaining > most)
+            {
+                most = remaining;
+                victim = &batch->queues[i];
+            }
+        }
+        if (victim == NULL)
+            return -1;
+        pthread_mutex_lock(&victim->mutex);
+        remaining = victim->end - victim->next;
+        end = victim->end;
+        victim->end -= (remaining + 1) / 2;
+        start = victim->end;
+        pthread_mutex_unlock(&victim->mutex);
+        if (remaining <= 0)
+            continue;
+        pthread_mutex_lock(&own->mutex);
+        own->next = start + 1;
+        own->end = end;
+        pthread_mutex_unlock(&own->mutex);
+        job = start;
+    }
+    return job;
+}
+
+static void *tiffTileWorkerThread(void *arg)
+{
+    tiffTileWorker *worker = (tiffTileWorker *)arg;
+    tiffTileBatch *batch = worker->batch;
+    tiffWriteContext context;
+    tiffWriteOptions *options;
+    tiffTileJob *job;
+    int i;
+    //
+    initTiffWriteContext(&context);
+    while ((i = nextTile(batch, worker->id)) >= 0)
+    {
+        job = &batch->jobs[i];
+        options = job->options;
+        // The tiles are the parallelism, so each is compressed single threaded
+        if (batch->nThreads > 1)
+        {
+            if (options == NULL)
+                initTiffWriteOptions(&context.options);
+            else
+                context.options = *options;
+            context.options.numThreads = 1;
+            options = &context.options;
+        }
+        writeGeotiff(&context, job->filename, job->bands, job->bandDescriptions, job->noDataValues, job->nBands,
+                     job->width, job->height, job->geoTransform, job->epsg, job->metaData, job->driverType,
+                     job->dataType, options);
+    }
+    return NULL;
+}
+
+/*
+  Write many GeoTIFF/COG tiles with nThreads threads (< 1 for all cores). Each thread has its own
+  drivers and options, and compresses its tiles single threaded. A tile that cannot be written exits
+  through error(), as for saveAsGeotiff, so the batch either completes or stops the process.
+*/
+void saveAsGeotiffBatch(tiffTileJob *jobs, int nJobs, int nThreads)
+{
+    tiffTileBatch batch;
+    tiffTileWorker *workers;
+    pthread_t *threads;
+    int i;
+    //
+    if (nJobs < 1)
+        return;
+    if (nThreads < 1)
+        nThreads = CPLGetNumCPUs();
+    if (nThreads > nJobs)
+        nThreads = nJobs;
+    batch.jobs = jobs;
+    batch.nThreads = nThreads;
+    batch.queues = (tileQueue *)CPLMalloc(sizeof(tileQueue) * nThreads);
+    workers = (tiffTileWorker *)CPLMalloc(sizeof(tiffTileWorker) * nThreads);
+    threads = (pthread_t *)CPLMalloc(sizeof(pthread_t) * nThreads);
+    for (i = 0; i < nThreads; i++)
+    {
+        pthread_mutex_init(&batch.queues[i].mutex, NULL);
+        batch.queues[i].next = (int)((int64_t)nJobs * i / nThreads);
+        batch.queues[i].end = (int)((int64_t)nJobs * (i + 1) / nThreads);
+        workers[i].batch = &batch;
+        workers[i].id = i;
+    }
+    double t0 = ioStatsStart();
+    if (nThreads == 1)
+        tiffTileWorkerThread(&workers[0]);
+    else
+    {
+        for (i = 0; i < nThreads; i++)
+            if (pthread_create(&threads[i], NULL, tiffTileWorkerThread, &workers[i]) != 0)
+                error("saveAsGeotiffBatch: Could not start writer thread\n");
+        for (i = 0; i < nThreads; i++)
+            pthread_join(threads[i], NULL);
+    }
+    ioStatsStop("saveAsGeotiffBatch", IOSTAT_WRITE, t0, 0);
+    for (i = 0; i < nThreads; i++)
+        pthread_mutex_destroy(&batch.queues[i].mutex);
+    CPLFree(batch.queues);
+    CPLFree(workers);
+    CPLFree(threads);
 }